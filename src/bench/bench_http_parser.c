@@ -0,0 +1,153 @@
+/// HTTP request parsing benchmark.
+/// Compares the incremental parser of temp_server with the sscanf/strstr parsing it replaced,
+/// both extracting the same query parameters from the same requests, and reports JSON lines:
+///
+///   {"parser":"slices","request":"browser","bytes":512,"ops":1000000,"ops_per_sec":...,"ns_per_op":...}
+///
+/// Parsers:
+///   sscanf  - strstr for the end of head, sscanf of request line and strstr/sscanf of every parameter
+///   slices  - parse_http_request and lookups of decoded parameters
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cross_time.h"
+#include "http_parser.h"
+#include "my_types.h"
+#include "utils.h"
+
+#define BENCH_DEFAULT_OPS 1000000
+#define BENCH_GET_MAX_LEN 1024
+
+#define _TO_TEXT(S) #S
+#define TO_TEXT(S) _TO_TEXT(S)
+
+typedef struct {
+    const char *name;
+    const char *text;
+} BenchRequest;
+
+static const BenchRequest REQUESTS[] = {
+    {"minimal", "GET / HTTP/1.1\r\n\r\n"},
+    {"curl",
+     "GET /?date_start=1700000000000&date_end=1700086400000&max_points=1920 HTTP/1.1\r\n"
+     "Host: localhost:8080\r\nUser-Agent: curl/8.5.0\r\nAccept: */*\r\n\r\n"},
+    {"browser",
+     "GET /?date_start=1700000000000&date_end=1700086400000&max_points=3840&mode=minmax HTTP/1.1\r\n"
+     "Host: localhost:8080\r\nConnection: keep-alive\r\nsec-ch-ua-platform: \"Linux\"\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+     "Chrome/120.0.0.0 Safari/537.36\r\n"
+     "Accept: */*\r\nOrigin: http://localhost:8000\r\nSec-Fetch-Site: same-site\r\n"
+     "Sec-Fetch-Mode: cors\r\nSec-Fetch-Dest: empty\r\nReferer: http://localhost:8000/\r\n"
+     "Accept-Encoding: gzip, deflate, br\r\nAccept-Language: en-US,en;q=0.9\r\n\r\n"},
+};
+
+typedef struct {
+    i64 date_start, date_end, max_points;
+    char mode[16];
+} Params;
+
+static int parse_sscanf(const char *request, Params *params);
+static int parse_slices(const char *request, usize len, Params *params);
+static void print_result(const char *parser, const BenchRequest *request, usize n_ops, f64 total_secs);
+
+int main(int argc, char *argv[])
+{
+    usize n_ops = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_DEFAULT_OPS;
+    if (n_ops == 0) {
+        fprintf(stderr, "Usage: bench_http_parser [OPS]\n");
+        exit(2);
+    }
+
+    for (usize i = 0; i < sizeof(REQUESTS) / sizeof(*REQUESTS); i++) {
+        const BenchRequest *request = &REQUESTS[i];
+        usize len = strlen(request->text);
+
+        // Both parsers must agree before they are compared
+        Params expected = {0}, actual = {0};
+        if (parse_sscanf(request->text, &expected) == -1 || parse_slices(request->text, len, &actual) == -1 ||
+            memcmp(&expected, &actual, sizeof(Params)) != 0) {
+            fprintf(stderr, "Parsers disagree on request \"%s\"\n", request->name);
+            exit(1);
+        }
+
+        int res = 0;
+        f64 start = get_secs();
+        for (usize j = 0; j < n_ops; j++) {
+            Params params = {0};
+            res |= parse_sscanf(request->text, &params);
+        }
+        print_result("sscanf", request, n_ops, get_secs() - start);
+
+        start = get_secs();
+        for (usize j = 0; j < n_ops; j++) {
+            Params params = {0};
+            res |= parse_slices(request->text, len, &params);
+        }
+        print_result("slices", request, n_ops, get_secs() - start);
+
+        if (res != 0) {
+            fprintf(stderr, "Failed to parse request \"%s\"\n", request->name);
+            exit(1);
+        }
+    }
+
+    return 0;
+}
+
+/// Parsing as temp_server did it before the incremental parser.
+/// Return 0 on success, -1 on error.
+static int parse_sscanf(const char *request, Params *params)
+{
+    if (strstr(request, "\r\n\r\n") == NULL)
+        return -1;
+
+    char get_query[BENCH_GET_MAX_LEN + 1];
+    f32 http_ver;
+    if (sscanf(request, "GET %" TO_TEXT(BENCH_GET_MAX_LEN) "s HTTP/%f", get_query, &http_ver) != 2)
+        return -1;
+
+    const char *str = strstr(get_query, "date_start=");
+    if (str != NULL && sscanf(str + 11, "%" SCNd64, &params->date_start) != 1)
+        return -1;
+    str = strstr(get_query, "date_end=");
+    if (str != NULL && sscanf(str + 9, "%" SCNd64, &params->date_end) != 1)
+        return -1;
+    str = strstr(get_query, "max_points=");
+    if (str != NULL && sscanf(str + 11, "%" SCNd64, &params->max_points) != 1)
+        return -1;
+    str = strstr(get_query, "mode=");
+    if (str != NULL && sscanf(str + 5, "%15[a-z]", params->mode) != 1)
+        return -1;
+    return 0;
+}
+
+/// Return 0 on success, -1 on error.
+static int parse_slices(const char *request, usize len, Params *params)
+{
+    HttpRequest http;
+    init_http_request(&http);
+    if (parse_http_request(&http, request, len) != HTTP_PARSE_DONE)
+        return -1;
+
+    if (parse_http_param_i64(&http, "date_start", &params->date_start) == -1 ||
+        parse_http_param_i64(&http, "date_end", &params->date_end) == -1 ||
+        parse_http_param_i64(&http, "max_points", &params->max_points) == -1)
+        return -1;
+
+    const Slice *mode = find_http_param(&http, "mode");
+    if (mode != NULL && decode_http_component(*mode, params->mode, sizeof(params->mode)) == -1)
+        return -1;
+    return 0;
+}
+
+static void print_result(const char *parser, const BenchRequest *request, usize n_ops, f64 total_secs)
+{
+    printf("{\"parser\":\"%s\",\"request\":\"%s\",\"bytes\":%zu,\"ops\":%zu,\"ops_per_sec\":%.1f,"
+           "\"ns_per_op\":%.1f}\n",
+           parser, request->name, strlen(request->text), n_ops, (f64)n_ops / total_secs,
+           total_secs * 1e9 / (f64)n_ops);
+    fflush(stdout);
+}
@@ -0,0 +1,263 @@
+/// Storage benchmark, built once for every logger backend.
+/// Drives the logger interface the same way temp_logger and temp_server do, on synthetic data
+/// with given number of rows and sample rate, and reports every measured operation as a JSON line:
+///
+///   {"backend":"db","op":"write_full","rows":1000,"rate_hz":1,"ops":1000,"ops_per_sec":...,
+///    "p50_ms":...,"p99_ms":...}
+///
+/// Operations:
+///   write_group  - begin_log_batch/write_log/end_log_batch with group commit, fills the log with rows
+///   write_full   - same with commit of every sample, as temp_logger does by default
+///   avg          - get_avg_log over PERIOD_LOG2 at the end of the log
+///   range_full   - get_array_entries over the whole log
+///   range_hour   - get_array_entries over the last hour of the log
+///   delete_old   - delete_old_entries, each call cutting a slice of the oldest rows
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cross_time.h"
+#include "logger_interface.h"
+#include "my_types.h"
+#include "temp_logger.h"
+
+#ifdef BENCH_BACKEND_FS
+#define BENCH_BACKEND "fs"
+#define BENCH_STORAGE_PATH "."
+#define BENCH_LOG_NAME "bench_storage_log.txt"
+#else
+#define BENCH_BACKEND "db"
+#define BENCH_STORAGE_PATH "bench_storage.db"
+#define BENCH_LOG_NAME "log1"
+#endif
+
+#define BENCH_DEFAULT_RATE_HZ 1.0
+#define BENCH_GROUP_SAMPLES 1000
+#define BENCH_FULL_WRITES 1000
+#define BENCH_WINDOW_SECS 3600
+#define BENCH_TARGET_ROWS 5000000 // Log size times repeats of read queries, big logs are read fewer times
+#define BENCH_MIN_REPEATS 5
+#define BENCH_MAX_REPEATS 100
+#define BENCH_DELETE_REPEATS 10
+#define BENCH_DELETE_FRACTION 0.1 // Part of the log deleted by all the delete_old repeats together
+
+#ifdef BENCH_BACKEND_FS
+// Text log is scanned line by line on every read and delete, 10M rows would take the better part of an hour
+static const usize DEFAULT_ROWS[] = {1000, 100000, 1000000};
+#else
+static const usize DEFAULT_ROWS[] = {1000, 100000, 10000000};
+#endif
+
+typedef struct {
+    usize n_rows;
+    f64 rate_hz;
+    f64 start_secs; // Time of the first row
+    f64 *times;     // Latency of every op of the current measurement
+    usize n_ops;
+} Bench;
+
+static void remove_storage(void);
+static int bench_write(Bench *bench, Log *log, LogStorage *storage, const char *op, f64 first_secs,
+                       usize n_writes);
+static int bench_avg(Bench *bench, Log *log, f64 end_secs);
+static int bench_range(Bench *bench, Log *log, const char *op, i64 start_ms, i64 end_ms);
+static int bench_delete(Bench *bench, Log *log);
+static void print_result(Bench *bench, const char *op, f64 total_secs);
+static usize clamp_repeats(usize n_repeats);
+static int cmp_f64(const void *a, const void *b);
+
+int main(int argc, char *argv[])
+{
+    f64 rate_hz = BENCH_DEFAULT_RATE_HZ;
+    int first_rows_arg = 1;
+    if (argc > 2 && strcmp(argv[1], "--rate") == 0) {
+        rate_hz = strtod(argv[2], NULL);
+        first_rows_arg = 3;
+    }
+
+    bool has_rows_args = argc > first_rows_arg;
+    usize n_sizes =
+        has_rows_args ? (usize)(argc - first_rows_arg) : sizeof(DEFAULT_ROWS) / sizeof(*DEFAULT_ROWS);
+    for (usize i = 0; i < n_sizes; i++) {
+        usize n_rows = has_rows_args ? strtoull(argv[first_rows_arg + i], NULL, 10) : DEFAULT_ROWS[i];
+        if (n_rows == 0 || rate_hz <= 0) {
+            fprintf(stderr, "Usage: bench_storage [--rate HZ] [ROWS...]\n");
+            exit(2);
+        }
+
+        Bench bench = {
+            .n_rows = n_rows,
+            .rate_hz = rate_hz,
+            .start_secs = get_secs() - (f64)n_rows / rate_hz,
+        };
+        bench.times = malloc(sizeof(f64) * (n_rows > BENCH_FULL_WRITES ? n_rows : BENCH_FULL_WRITES));
+        if (bench.times == NULL) {
+            fprintf(stderr, "Failed to allocate memory for %zu latencies\n", n_rows);
+            exit(1);
+        }
+
+        remove_storage();
+        LogStorage *storage = open_log_storage(BENCH_STORAGE_PATH);
+        Log *log = init_log(storage, BENCH_LOG_NAME);
+
+        LogDurability group = {
+            .commit_samples = BENCH_GROUP_SAMPLES, .commit_period = 0, .sync = LOG_SYNC_NORMAL};
+        LogDurability full = {.commit_samples = 1, .commit_period = 0, .sync = LOG_SYNC_FULL};
+
+        int res = set_log_durability(storage, &group);
+        res |= bench_write(&bench, log, storage, "write_group", bench.start_secs, n_rows);
+        res |= set_log_durability(storage, &full);
+        res |= bench_write(&bench, log, storage, "write_full", bench.start_secs + (f64)n_rows / rate_hz,
+                           BENCH_FULL_WRITES);
+        bench.n_rows += BENCH_FULL_WRITES;
+
+        f64 end_secs = bench.start_secs + (f64)bench.n_rows / rate_hz;
+        res |= bench_avg(&bench, log, end_secs);
+        res |= bench_range(&bench, log, "range_full", INT64_MIN, INT64_MAX);
+        res |= bench_range(&bench, log, "range_hour", llround((end_secs - BENCH_WINDOW_SECS) * 1000),
+                           llround(end_secs * 1000));
+        res |= bench_delete(&bench, log);
+
+        res |= deinit_log(log);
+        res |= close_log_storage(storage);
+        remove_storage();
+        free(bench.times);
+
+        if (res != 0) {
+            fprintf(stderr, "Benchmark failed for %zu rows\n", n_rows);
+            exit(1);
+        }
+    }
+
+    return 0;
+}
+
+static void remove_storage(void)
+{
+#ifdef BENCH_BACKEND_FS
+    remove(BENCH_STORAGE_PATH "/" BENCH_LOG_NAME);
+#else
+    const char *suffixes[] = {"", "-wal", "-shm"};
+    for (usize i = 0; i < sizeof(suffixes) / sizeof(*suffixes); i++) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "%s%s", BENCH_STORAGE_PATH, suffixes[i]);
+        remove(buf);
+    }
+#endif
+}
+
+/// Write n_writes samples one period of the rate apart, each in its own batch like temp_logger does.
+/// Pending samples are flushed at the end, and that time is counted into throughput.
+/// Return 0 on success, -1 on error.
+static int bench_write(Bench *bench, Log *log, LogStorage *storage, const char *op, f64 first_secs,
+                       usize n_writes)
+{
+    usize max_period = (usize)((f64)(bench->n_rows + n_writes) / bench->rate_hz) + 1;
+
+    bench->n_ops = 0;
+    f64 start = get_secs();
+    for (usize i = 0; i < n_writes; i++) {
+        i64 ts_ms = llround((first_secs + (f64)i / bench->rate_hz) * 1000);
+        f64 value = 20.0 + (f64)(i % 100) / 10;
+
+        f64 t0 = get_secs();
+        int res = begin_log_batch(storage);
+        res |= write_log(log, value, ts_ms, max_period);
+        res |= end_log_batch(storage);
+        bench->times[bench->n_ops++] = get_secs() - t0;
+        if (res != 0)
+            return -1;
+    }
+    if (flush_log_storage(storage) == -1)
+        return -1;
+
+    print_result(bench, op, get_secs() - start);
+    return 0;
+}
+
+static int bench_avg(Bench *bench, Log *log, f64 end_secs)
+{
+    i64 end_ms = llround(end_secs * 1000);
+    usize n_repeats = clamp_repeats(BENCH_TARGET_ROWS / bench->n_rows);
+
+    bench->n_ops = 0;
+    f64 start = get_secs();
+    for (usize i = 0; i < n_repeats; i++) {
+        f64 t0 = get_secs();
+        f64 avg = get_avg_log(log, PERIOD_LOG2, end_ms);
+        bench->times[bench->n_ops++] = get_secs() - t0;
+        if (avg == INFINITY)
+            return -1;
+    }
+
+    print_result(bench, "avg", get_secs() - start);
+    return 0;
+}
+
+static int bench_range(Bench *bench, Log *log, const char *op, i64 start_ms, i64 end_ms)
+{
+    usize n_repeats = clamp_repeats(BENCH_TARGET_ROWS / bench->n_rows);
+
+    bench->n_ops = 0;
+    f64 bench_start = get_secs();
+    for (usize i = 0; i < n_repeats; i++) {
+        f64 t0 = get_secs();
+        TempArray *array = get_array_entries(log, start_ms, end_ms);
+        bench->times[bench->n_ops++] = get_secs() - t0;
+        if (array == NULL)
+            return -1;
+        free(array->items);
+        free(array);
+    }
+
+    print_result(bench, op, get_secs() - bench_start);
+    return 0;
+}
+
+static int bench_delete(Bench *bench, Log *log)
+{
+    f64 slice_secs = (f64)bench->n_rows * BENCH_DELETE_FRACTION / BENCH_DELETE_REPEATS / bench->rate_hz;
+
+    bench->n_ops = 0;
+    f64 start = get_secs();
+    for (usize i = 0; i < BENCH_DELETE_REPEATS; i++) {
+        i64 cutoff_ms = llround((bench->start_secs + slice_secs * (f64)(i + 1)) * 1000);
+
+        f64 t0 = get_secs();
+        int res = delete_old_entries(log, cutoff_ms, 0);
+        bench->times[bench->n_ops++] = get_secs() - t0;
+        if (res == -1)
+            return -1;
+    }
+
+    print_result(bench, "delete_old", get_secs() - start);
+    return 0;
+}
+
+/// Print measurement as a JSON line, latencies are sorted in place.
+static void print_result(Bench *bench, const char *op, f64 total_secs)
+{
+    qsort(bench->times, bench->n_ops, sizeof(f64), cmp_f64);
+    f64 p50 = bench->times[bench->n_ops / 2];
+    f64 p99 = bench->times[bench->n_ops * 99 / 100];
+    printf("{\"backend\":\"%s\",\"op\":\"%s\",\"rows\":%zu,\"rate_hz\":%g,\"ops\":%zu,"
+           "\"ops_per_sec\":%.1f,\"p50_ms\":%.4f,\"p99_ms\":%.4f}\n",
+           BENCH_BACKEND, op, bench->n_rows, bench->rate_hz, bench->n_ops, (f64)bench->n_ops / total_secs,
+           p50 * 1e3, p99 * 1e3);
+    fflush(stdout);
+}
+
+static usize clamp_repeats(usize n_repeats)
+{
+    if (n_repeats < BENCH_MIN_REPEATS)
+        return BENCH_MIN_REPEATS;
+    return n_repeats > BENCH_MAX_REPEATS ? BENCH_MAX_REPEATS : n_repeats;
+}
+
+static int cmp_f64(const void *a, const void *b)
+{
+    f64 x = *(const f64 *)a, y = *(const f64 *)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,187 @@
+/// Lines are copied into the ring buffer under a mutex and the writer thread takes all of them at once,
+/// so the lock is held only for memcpy on both sides and the file is written outside of it.
+
+#include "access_log.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cross_thread.h"
+#include "cross_time.h"
+#include "my_types.h"
+#include "utils.h"
+
+static const char *const LEVEL_NAMES[] = {"error", "info", "debug"};
+
+struct AccessLog {
+    FILE *out;
+    AccessLogLevel level;
+    Thread thread;
+    Mutex mutex;
+    CondVar not_empty;
+    bool is_stopping;
+
+    char *ring;
+    usize capacity;
+    usize head;      // Start of the oldest byte not written yet
+    usize len;       // Bytes waiting to be written
+    usize n_dropped; // Lines dropped since the last write
+};
+
+static void *writer_main(void *arg);
+
+int parse_access_log_level(const char *name, AccessLogLevel *level)
+{
+    for (usize i = 0; i < sizeof(LEVEL_NAMES) / sizeof(*LEVEL_NAMES); i++) {
+        if (streql(name, LEVEL_NAMES[i])) {
+            *level = (AccessLogLevel)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+AccessLog *start_access_log(FILE *out, AccessLogLevel level, usize capacity)
+{
+    assert(capacity >= ACCESS_LOG_LINE_MAX_LEN);
+
+    AccessLog *log = xmalloc(sizeof(AccessLog));
+    log->out = out;
+    log->level = level;
+    log->is_stopping = false;
+    log->ring = xmalloc(capacity);
+    log->capacity = capacity;
+    log->head = 0;
+    log->len = 0;
+    log->n_dropped = 0;
+    init_mutex(&log->mutex);
+    init_cond(&log->not_empty);
+
+    usize err = start_thread(&log->thread, writer_main, log);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start access log thread: %s (%zu)\n", strerror(err), err);
+        exit(1);
+    }
+    return log;
+}
+
+void stop_access_log(AccessLog *log)
+{
+    lock_mutex(&log->mutex);
+    log->is_stopping = true;
+    signal_cond(&log->not_empty);
+    unlock_mutex(&log->mutex);
+    join_thread(log->thread);
+
+    destroy_cond(&log->not_empty);
+    destroy_mutex(&log->mutex);
+    free(log->ring);
+    free(log);
+}
+
+bool is_access_log_enabled(const AccessLog *log, AccessLogLevel level)
+{
+    return level <= log->level;
+}
+
+void write_access_log(AccessLog *log, AccessLogLevel level, const char *format, ...)
+{
+    if (!is_access_log_enabled(log, level))
+        return;
+
+    char line[ACCESS_LOG_LINE_MAX_LEN + 1];
+    int n = snprintf(line, sizeof(line), "time=%.3f level=%s ", get_secs(), LEVEL_NAMES[level]);
+
+    va_list args;
+    va_start(args, format);
+    int n_message = vsnprintf(line + n, sizeof(line) - n, format, args);
+    va_end(args);
+
+    // Truncated line still ends with a newline
+    usize len = n + (n_message > 0 ? n_message : 0);
+    if (len > ACCESS_LOG_LINE_MAX_LEN - 1)
+        len = ACCESS_LOG_LINE_MAX_LEN - 1;
+    line[len++] = '\n';
+
+    lock_mutex(&log->mutex);
+    if (log->capacity - log->len < len) {
+        log->n_dropped++;
+    } else {
+        usize tail = (log->head + log->len) % log->capacity;
+        usize first_len = log->capacity - tail < len ? log->capacity - tail : len;
+        memcpy(log->ring + tail, line, first_len);
+        memcpy(log->ring, line + first_len, len - first_len);
+        log->len += len;
+        signal_cond(&log->not_empty);
+    }
+    unlock_mutex(&log->mutex);
+}
+
+void escape_access_log_value(char *dest, usize dest_size, const char *src, usize len)
+{
+    assert(dest_size >= 8);
+
+    // Longest escape sequence and "..." always fit after the last written byte
+    usize pos = 0;
+    for (usize i = 0; i < len; i++) {
+        if (pos + 4 + 3 >= dest_size) {
+            memcpy(dest + pos, "...", 3);
+            pos += 3;
+            break;
+        }
+
+        u8 c = (u8)src[i];
+        if (c == '"' || c == '\\') {
+            dest[pos++] = '\\';
+            dest[pos++] = (char)c;
+        } else if (c == '\r' || c == '\n') {
+            dest[pos++] = '\\';
+            dest[pos++] = c == '\r' ? 'r' : 'n';
+        } else if (c >= 0x20 && c < 0x7f) {
+            dest[pos++] = (char)c;
+        } else {
+            pos += sprintf(dest + pos, "\\x%02x", c);
+        }
+    }
+    dest[pos] = '\0';
+}
+
+/// Write out whatever is buffered until the log is stopped and drained.
+static void *writer_main(void *arg)
+{
+    AccessLog *log = arg;
+    char *buf = xmalloc(log->capacity);
+
+    lock_mutex(&log->mutex);
+    while (true) {
+        while (log->len == 0 && log->n_dropped == 0 && !log->is_stopping)
+            wait_cond(&log->not_empty, &log->mutex);
+        if (log->len == 0 && log->n_dropped == 0)
+            break;
+
+        usize len = log->len;
+        usize first_len = log->capacity - log->head < len ? log->capacity - log->head : len;
+        memcpy(buf, log->ring + log->head, first_len);
+        memcpy(buf + first_len, log->ring, len - first_len);
+        log->head = (log->head + len) % log->capacity;
+        log->len = 0;
+        usize n_dropped = log->n_dropped;
+        log->n_dropped = 0;
+        unlock_mutex(&log->mutex);
+
+        fwrite(buf, 1, len, log->out);
+        if (n_dropped > 0)
+            fprintf(log->out, "time=%.3f level=error msg=\"Access log buffer is full, %zu lines dropped\"\n",
+                    get_secs(), n_dropped);
+        fflush(log->out);
+
+        lock_mutex(&log->mutex);
+    }
+    unlock_mutex(&log->mutex);
+
+    free(buf);
+    return NULL;
+}
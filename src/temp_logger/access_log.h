@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "my_types.h"
+
+#define ACCESS_LOG_LINE_MAX_LEN 4096 // Longer lines are truncated
+
+typedef enum {
+    ACCESS_LOG_ERROR, // Failures only
+    ACCESS_LOG_INFO,  // And a line per request
+    ACCESS_LOG_DEBUG, // And request heads and response payloads
+} AccessLogLevel;
+
+/// Log of logfmt lines, "time=1700000000.123 level=info key=value ...", shared by all the threads.
+/// Lines are formatted by the calling thread into an in-memory ring buffer, which a background thread
+/// writes out, so logging never waits for I/O. Lines which don't fit into the buffer are dropped
+/// and counted, the count is written once there is space again.
+struct AccessLog;
+typedef struct AccessLog AccessLog;
+
+/// Parse level name: "error", "info" or "debug".
+/// Return 0 on success, -1 on unknown name.
+int parse_access_log_level(const char *name, AccessLogLevel *level);
+
+/// Start thread writing lines of level or more important ones to out through buffer of capacity bytes.
+/// Exit with code 1 on failure.
+AccessLog *start_access_log(FILE *out, AccessLogLevel level, usize capacity);
+
+/// Write out the buffered lines, stop the thread and free the log.
+void stop_access_log(AccessLog *log);
+
+/// Check if lines of the level are written, to skip preparing the ones which aren't.
+bool is_access_log_enabled(const AccessLog *log, AccessLogLevel level);
+
+/// Format line of printf format and arguments after time and level, and queue it for writing.
+void write_access_log(AccessLog *log, AccessLogLevel level, const char *format, ...);
+
+/// Escape payload as logfmt quoted value: printable ASCII is kept, quotes and backslashes are escaped,
+/// other bytes are written as \r, \n or \xHH. Payload which doesn't fit is cut and ends with "...".
+/// dest gets null-terminated value without quotes, dest_size has to be at least 8.
+void escape_access_log_value(char *dest, usize dest_size, const char *src, usize len);
@@ -0,0 +1,195 @@
+/// Downsampling of log entries for plotting: the client can't draw more points than its canvas has pixels,
+/// so there is no point to serialize and send them.
+///
+/// All the algorithms split time-sorted entries into buckets of equal number of entries
+/// and write selected entries back to the items of the input array.
+
+#include "downsample.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger_interface.h"
+#include "my_types.h"
+
+/// Entry with its time in seconds, converted once for comparator and triangle areas.
+typedef struct {
+    f64 secs;
+    TempEntry entry;
+} TimedEntry;
+
+static int compare_timed_entries(const void *a, const void *b);
+static usize downsample_lttb(const TimedEntry *in, usize n, TempEntry *out, usize n_out);
+static usize downsample_minmax(const TimedEntry *in, usize n, TempEntry *out, usize n_out);
+static usize downsample_avg(const TimedEntry *in, usize n, TempEntry *out, usize n_out);
+
+int parse_downsample_mode(const char *name, DownsampleMode *mode)
+{
+    if (strcmp(name, "lttb") == 0)
+        *mode = DOWNSAMPLE_LTTB;
+    else if (strcmp(name, "minmax") == 0)
+        *mode = DOWNSAMPLE_MINMAX;
+    else if (strcmp(name, "avg") == 0)
+        *mode = DOWNSAMPLE_AVG;
+    else
+        return -1;
+    return 0;
+}
+
+int downsample_array(TempArray *array, usize max_points, DownsampleMode mode)
+{
+    if (array->size == 0)
+        return 0;
+
+    TimedEntry *timed = malloc(sizeof(TimedEntry) * array->size);
+    if (timed == NULL) {
+        fprintf(stderr, "Failed to malloc for %zu timed entries: %s (%d)\n", array->size, strerror(errno),
+                errno);
+        return -1;
+    }
+
+    usize n = 0;
+    for (usize i = 0; i < array->size; i++) {
+        if (memcmp(&array->items[i], &(TempEntry){0}, sizeof(TempEntry)) == 0)
+            continue;
+        f64 secs = (f64)array->items[i].ts_ms / 1000;
+        timed[n++] = (TimedEntry){.secs = secs, .entry = array->items[i]};
+    }
+    qsort(timed, n, sizeof(TimedEntry), compare_timed_entries);
+
+    if (n <= max_points || max_points == 0) {
+        for (usize i = 0; i < n; i++)
+            array->items[i] = timed[i].entry;
+        array->size = n;
+    } else if (mode == DOWNSAMPLE_MINMAX) {
+        array->size = downsample_minmax(timed, n, array->items, max_points);
+    } else if (mode == DOWNSAMPLE_AVG) {
+        array->size = downsample_avg(timed, n, array->items, max_points);
+    } else {
+        array->size = downsample_lttb(timed, n, array->items, max_points);
+    }
+
+    free(timed);
+    return 0;
+}
+
+static int compare_timed_entries(const void *a, const void *b)
+{
+    f64 secs_a = ((const TimedEntry *)a)->secs;
+    f64 secs_b = ((const TimedEntry *)b)->secs;
+    return (secs_a > secs_b) - (secs_a < secs_b);
+}
+
+/// Largest-Triangle-Three-Buckets by Sveinn Steinarsson.
+/// First and last entries are kept, the rest is split into n_out - 2 buckets.
+/// From each bucket the entry forming the largest triangle with the previously selected entry
+/// and the average of the next bucket is selected.
+static usize downsample_lttb(const TimedEntry *in, usize n, TempEntry *out, usize n_out)
+{
+    if (n_out < 3) {
+        out[0] = in[0].entry;
+        if (n_out == 2)
+            out[1] = in[n - 1].entry;
+        return n_out;
+    }
+
+    usize n_buckets = n_out - 2;
+    f64 bucket_size = (f64)(n - 2) / n_buckets;
+
+    const TimedEntry *prev = &in[0];
+    usize n_written = 0;
+    out[n_written++] = in[0].entry;
+
+    for (usize b = 0; b < n_buckets; b++) {
+        usize start = 1 + (usize)(b * bucket_size);
+        usize end = 1 + (usize)((b + 1) * bucket_size);
+
+        // Average of the next bucket, which is the last entry for the last bucket.
+        usize next_start = end;
+        usize next_end = b + 1 == n_buckets ? n : 1 + (usize)((b + 2) * bucket_size);
+        f64 avg_x = 0, avg_y = 0;
+        for (usize i = next_start; i < next_end; i++) {
+            avg_x += in[i].secs;
+            avg_y += in[i].entry.temp;
+        }
+        avg_x /= next_end - next_start;
+        avg_y /= next_end - next_start;
+
+        f64 max_area = -1;
+        usize max_i = start;
+        for (usize i = start; i < end; i++) {
+            // Doubled triangle area, the factor doesn't matter for comparison
+            f64 area = fabs((prev->secs - avg_x) * (in[i].entry.temp - prev->entry.temp) -
+                            (prev->secs - in[i].secs) * (avg_y - prev->entry.temp));
+            if (area > max_area) {
+                max_area = area;
+                max_i = i;
+            }
+        }
+
+        prev = &in[max_i];
+        out[n_written++] = prev->entry;
+    }
+
+    out[n_written++] = in[n - 1].entry;
+    return n_written;
+}
+
+/// Minimum and maximum of each of n_out / 2 buckets, written in the order they happened.
+/// A single entry has no room for both, so the middle one is written then.
+static usize downsample_minmax(const TimedEntry *in, usize n, TempEntry *out, usize n_out)
+{
+    if (n_out < 2) {
+        out[0] = in[n / 2].entry;
+        return 1;
+    }
+
+    usize n_buckets = n_out / 2;
+    f64 bucket_size = (f64)n / n_buckets;
+
+    usize n_written = 0;
+    for (usize b = 0; b < n_buckets; b++) {
+        usize start = (usize)(b * bucket_size);
+        usize end = b + 1 == n_buckets ? n : (usize)((b + 1) * bucket_size);
+
+        usize min_i = start, max_i = start;
+        for (usize i = start + 1; i < end; i++) {
+            if (in[i].entry.temp < in[min_i].entry.temp)
+                min_i = i;
+            if (in[i].entry.temp > in[max_i].entry.temp)
+                max_i = i;
+        }
+
+        TempEntry min = in[min_i].entry, max = in[max_i].entry;
+        if (min_i == max_i) {
+            out[n_written++] = min;
+        } else if (min_i < max_i) {
+            out[n_written++] = min;
+            out[n_written++] = max;
+        } else {
+            out[n_written++] = max;
+            out[n_written++] = min;
+        }
+    }
+    return n_written;
+}
+
+static usize downsample_avg(const TimedEntry *in, usize n, TempEntry *out, usize n_out)
+{
+    f64 bucket_size = (f64)n / n_out;
+
+    for (usize b = 0; b < n_out; b++) {
+        usize start = (usize)(b * bucket_size);
+        usize end = b + 1 == n_out ? n : (usize)((b + 1) * bucket_size);
+
+        f64 sum = 0;
+        for (usize i = start; i < end; i++)
+            sum += in[i].entry.temp;
+
+        out[b] = (TempEntry){.ts_ms = in[start + (end - start) / 2].entry.ts_ms, .temp = sum / (end - start)};
+    }
+    return n_out;
+}
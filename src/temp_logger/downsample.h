@@ -0,0 +1,19 @@
+#pragma once
+
+#include "logger_interface.h"
+#include "my_types.h"
+
+typedef enum {
+    DOWNSAMPLE_LTTB,   // Largest-Triangle-Three-Buckets, keeps the visual shape of the curve
+    DOWNSAMPLE_MINMAX, // Minimum and maximum of each bucket in time order, keeps spikes
+    DOWNSAMPLE_AVG,    // Average of each bucket, dated by its middle entry
+} DownsampleMode;
+
+/// Parse mode name: "lttb", "minmax" or "avg".
+/// Return 0 on success, -1 on unknown name.
+int parse_downsample_mode(const char *name, DownsampleMode *mode);
+
+/// Sort array by date and drop null entries, then reduce it in place to at most max_points entries.
+/// Array of max_points entries or less is only sorted.
+/// Return 0 on success, -1 on error.
+int downsample_array(TempArray *array, usize max_points, DownsampleMode mode);
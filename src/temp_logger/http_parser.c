@@ -0,0 +1,233 @@
+/// Minimal HTTP/1.x request head parser.
+/// It only splits the request into slices of the receive buffer, so nothing is copied or allocated,
+/// and the request line, headers and query parameters are looked up through them.
+/// Request body is not supported, as the server only handles GET.
+
+#include "http_parser.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "my_types.h"
+#include "utils.h"
+
+static int parse_request_line(HttpRequest *request, const char *line, usize len);
+static int parse_header_line(HttpRequest *request, const char *line, usize len);
+static int parse_query(HttpRequest *request);
+static Slice trim_slice(Slice slice);
+static int hex_value(char c);
+
+void init_http_request(HttpRequest *request)
+{
+    request->pos = 0;
+    request->is_started = false;
+    request->len = 0;
+    request->method = request->path = request->query = (Slice){0};
+    request->version_minor = 0;
+    request->n_headers = 0;
+    request->n_params = 0;
+}
+
+HttpParseResult parse_http_request(HttpRequest *request, const char *buf, usize len)
+{
+    while (request->pos < len) {
+        const char *line = buf + request->pos;
+        const char *line_end = memchr(line, '\n', len - request->pos);
+        if (line_end == NULL)
+            return HTTP_PARSE_PARTIAL;
+
+        usize line_len = line_end - line;
+        if (line_len > 0 && line[line_len - 1] == '\r')
+            line_len--;
+        request->pos = line_end + 1 - buf;
+
+        if (!request->is_started) {
+            if (line_len == 0) // Empty lines before request line are allowed
+                continue;
+            if (parse_request_line(request, line, line_len) == -1)
+                return HTTP_PARSE_ERROR;
+            request->is_started = true;
+        } else if (line_len == 0) {
+            request->len = request->pos;
+            return HTTP_PARSE_DONE;
+        } else if (parse_header_line(request, line, line_len) == -1) {
+            return HTTP_PARSE_ERROR;
+        }
+    }
+    return HTTP_PARSE_PARTIAL;
+}
+
+const Slice *find_http_header(const HttpRequest *request, const char *name)
+{
+    for (usize i = 0; i < request->n_headers; i++) {
+        if (slice_eql_nocase(request->headers[i].name, name))
+            return &request->headers[i].value;
+    }
+    return NULL;
+}
+
+const Slice *find_http_param(const HttpRequest *request, const char *key)
+{
+    char decoded[HTTP_PARAM_MAX_LEN + 1];
+    for (usize i = 0; i < request->n_params; i++) {
+        if (decode_http_component(request->params[i].key, decoded, sizeof(decoded)) != -1 &&
+            streql(decoded, key))
+            return &request->params[i].value;
+    }
+    return NULL;
+}
+
+i64 decode_http_component(Slice slice, char *dest, usize dest_size)
+{
+    usize n = 0;
+    for (usize i = 0; i < slice.len; i++, n++) {
+        if (n + 1 >= dest_size)
+            return -1;
+
+        char c = slice.ptr[i];
+        if (c == '+') {
+            dest[n] = ' ';
+        } else if (c != '%') {
+            dest[n] = c;
+        } else {
+            if (i + 2 >= slice.len)
+                return -1;
+            int hi = hex_value(slice.ptr[i + 1]), lo = hex_value(slice.ptr[i + 2]);
+            if (hi == -1 || lo == -1)
+                return -1;
+            dest[n] = (char)(hi * 16 + lo);
+            i += 2;
+        }
+    }
+    dest[n] = '\0';
+    return (i64)n;
+}
+
+int parse_http_param_i64(const HttpRequest *request, const char *key, i64 *value)
+{
+    const Slice *slice = find_http_param(request, key);
+    if (slice == NULL)
+        return 0;
+
+    char decoded[HTTP_PARAM_MAX_LEN + 1];
+    if (decode_http_component(*slice, decoded, sizeof(decoded)) <= 0)
+        return -1;
+
+    char *end;
+    errno = 0;
+    long long parsed = strtoll(decoded, &end, 10);
+    if (errno != 0 || *end != '\0')
+        return -1;
+
+    *value = parsed;
+    return 1;
+}
+
+bool slice_eql_nocase(Slice slice, const char *str)
+{
+    return strlen(str) == slice.len && strneql_nocase(slice.ptr, str, slice.len);
+}
+
+/// Parse "METHOD TARGET HTTP/1.x" line.
+/// Return 0 on success, -1 on error.
+static int parse_request_line(HttpRequest *request, const char *line, usize len)
+{
+    const char *method_end = memchr(line, ' ', len);
+    if (method_end == NULL || method_end == line)
+        return -1;
+
+    const char *target = method_end + 1;
+    const char *target_end = memchr(target, ' ', line + len - target);
+    if (target_end == NULL || target_end == target)
+        return -1;
+
+    const char *version = target_end + 1;
+    usize version_len = line + len - version;
+    if (version_len != 8 || strncmp(version, "HTTP/1.", 7) != 0 || version[7] < '0' || version[7] > '9')
+        return -1;
+
+    request->method = (Slice){line, method_end - line};
+    request->version_minor = (u8)(version[7] - '0');
+
+    const char *query = memchr(target, '?', target_end - target);
+    if (query == NULL) {
+        request->path = (Slice){target, target_end - target};
+        request->query = (Slice){target_end, 0};
+    } else {
+        request->path = (Slice){target, query - target};
+        request->query = (Slice){query + 1, target_end - query - 1};
+    }
+    return parse_query(request);
+}
+
+/// Parse "Name: value" line.
+/// Return 0 on success, -1 on error.
+static int parse_header_line(HttpRequest *request, const char *line, usize len)
+{
+    if (request->n_headers == HTTP_MAX_HEADERS)
+        return -1;
+
+    // Whitespace is not allowed in the name, which also rejects obsolete line folding
+    const char *colon = memchr(line, ':', len);
+    if (colon == NULL || colon == line || memchr(line, ' ', colon - line) != NULL ||
+        memchr(line, '\t', colon - line) != NULL)
+        return -1;
+
+    HttpHeader *header = &request->headers[request->n_headers++];
+    header->name = (Slice){line, colon - line};
+    header->value = trim_slice((Slice){colon + 1, line + len - colon - 1});
+    return 0;
+}
+
+/// Split query into "key=value" parameters separated by '&', empty ones are skipped.
+/// Return 0 on success, -1 if there are too many parameters.
+static int parse_query(HttpRequest *request)
+{
+    const char *pos = request->query.ptr;
+    const char *end = request->query.ptr + request->query.len;
+    while (pos < end) {
+        const char *param_end = memchr(pos, '&', end - pos);
+        if (param_end == NULL)
+            param_end = end;
+
+        if (param_end != pos) {
+            if (request->n_params == HTTP_MAX_PARAMS)
+                return -1;
+
+            HttpParam *param = &request->params[request->n_params++];
+            const char *eq = memchr(pos, '=', param_end - pos);
+            if (eq == NULL) {
+                param->key = (Slice){pos, param_end - pos};
+                param->value = (Slice){param_end, 0};
+            } else {
+                param->key = (Slice){pos, eq - pos};
+                param->value = (Slice){eq + 1, param_end - eq - 1};
+            }
+        }
+        pos = param_end + 1;
+    }
+    return 0;
+}
+
+static Slice trim_slice(Slice slice)
+{
+    while (slice.len > 0 && (slice.ptr[0] == ' ' || slice.ptr[0] == '\t')) {
+        slice.ptr++;
+        slice.len--;
+    }
+    while (slice.len > 0 && (slice.ptr[slice.len - 1] == ' ' || slice.ptr[slice.len - 1] == '\t'))
+        slice.len--;
+    return slice;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "my_types.h"
+
+#define HTTP_MAX_HEADERS 32
+#define HTTP_MAX_PARAMS 16
+#define HTTP_PARAM_MAX_LEN 64 // Longest decoded query key or value which can be looked up or parsed
+
+/// Part of the receive buffer, not null-terminated.
+typedef struct {
+    const char *ptr;
+    usize len;
+} Slice;
+
+typedef struct {
+    Slice name;
+    Slice value; // Without surrounding whitespace
+} HttpHeader;
+
+/// Query parameter, key and value are percent-encoded as received.
+typedef struct {
+    Slice key;
+    Slice value;
+} HttpParam;
+
+typedef enum {
+    HTTP_PARSE_DONE,    // Request is complete
+    HTTP_PARSE_PARTIAL, // Request is incomplete, call again once more data is received
+    HTTP_PARSE_ERROR,   // Request is malformed or exceeds limits
+} HttpParseResult;
+
+/// Request head parsed in place: all the slices point into the receive buffer,
+/// which must not be moved or overwritten while the request is in use.
+/// Parsing is incremental: every call continues from the last complete line of the previous one.
+typedef struct {
+    usize pos;       // Start of the first line not parsed yet
+    bool is_started; // Request line is parsed
+    usize len;       // Length of request head including final empty line, set once it's done
+
+    Slice method;
+    Slice path;
+    Slice query; // Empty if there is no query
+    u8 version_minor; // HTTP/1.x
+
+    HttpHeader headers[HTTP_MAX_HEADERS];
+    usize n_headers;
+    HttpParam params[HTTP_MAX_PARAMS];
+    usize n_params;
+} HttpRequest;
+
+/// Reset parser state before parsing a new request.
+void init_http_request(HttpRequest *request);
+
+/// Parse request head from buf, which holds len bytes received so far starting at the request.
+/// Buffer may hold more data after the request, e.g. pipelined requests.
+/// Return parsing result.
+HttpParseResult parse_http_request(HttpRequest *request, const char *buf, usize len);
+
+/// Find header by name, ignoring case.
+/// Return pointer to its value or NULL if there is no such header.
+const Slice *find_http_header(const HttpRequest *request, const char *name);
+
+/// Find query parameter by its decoded key.
+/// Return pointer to its encoded value or NULL if there is no such parameter.
+const Slice *find_http_param(const HttpRequest *request, const char *key);
+
+/// Decode percent-encoded query component to dest as null-terminated string, '+' is decoded as space.
+/// Return decoded length, or -1 if slice is malformed or doesn't fit into dest_size.
+i64 decode_http_component(Slice slice, char *dest, usize dest_size);
+
+/// Parse decoded value of query parameter as a whole signed integer.
+/// Return 1 if parsed, 0 if there is no such parameter, -1 if value is invalid.
+int parse_http_param_i64(const HttpRequest *request, const char *key, i64 *value);
+
+/// Check whether slice equals string, ignoring ASCII case.
+bool slice_eql_nocase(Slice slice, const char *str);
@@ -1,6 +1,5 @@
 #include "logger_interface.h"
 
-#include <assert.h>
 #include <errno.h>
 #include <math.h>
 #include <stdarg.h>
@@ -16,65 +15,271 @@
 #include "temp_logger.h"
 #include "utils.h"
 
-#define SELECT_BETWEEN_DATE_FQUERY "select date, temp from %s where DATETIME(date) between '%s' and '%s';"
-#define COUNT_BETWEEN_DATE_FQUERY "select count(1) from %s where DATETIME(date) between '%s' and '%s';"
-#define SELECT_BY_ID_FQUERY "select id, date from %s order by id;"
-#define DELETE_BY_ID_FQUERY "delete from %s where id = %d;"
-#define INSERT_FQUERY "insert into %s (date, temp) values ('%s', %lf);"
-
+// Table name is substituted once with sqlite3_mprintf, the values are bound on every call.
+// All the range queries filter on bare ts_ms, so they are served by the ts_ms index.
+// Index entries of the same time are ordered by row id, so are the rows, and ?3 skips the ones at ?1
+// up to that id, to resume reading right after a row.
+#define SELECT_BETWEEN_DATE_FQUERY                                                                           \
+    "select ts_ms, temp, id from \"%w\" where ts_ms between ?1 and ?2 and (ts_ms > ?1 or id > ?3)"           \
+    " order by ts_ms, id;"
+#define DELETE_OLD_FQUERY "delete from \"%w\" where ts_ms < ?1;"
+#define INSERT_FQUERY "insert into \"%w\" (ts_ms, temp) values (?1, ?2);"
+// Both are looked up in the primary key b-tree, so it's cheap regardless of table size.
+#define SELECT_VERSION_FQUERY "select min(id), max(id) from \"%w\";"
+#define SELECT_BETWEEN_ID_FQUERY                                                                             \
+    "select ts_ms, temp, id from \"%w\" where id > ?1 and id <= ?2 order by id;"
+// Looked up at the end of the ts_ms index.
+#define SELECT_LAST_TIME_FQUERY "select max(ts_ms) from \"%w\";"
+
+// Schema version 2: unix-epoch milliseconds in an indexed integer column.
+// Row ids are autoincrement, so they are not reused even after retention deletes every row.
 #define CREATE_TABLE_FQUERY                                                                                  \
-    "create table if not exists %s"                                                                          \
-    "(id integer primary key,                                                                                \
-    date datetime not null,                                                                                  \
+    "create table if not exists \"%w\""                                                                      \
+    "(id integer primary key autoincrement,                                                                  \
+    ts_ms integer not null,                                                                                  \
     temp float not null);"
+#define CREATE_INDEX_FQUERY "create index if not exists \"%w_ts_ms\" on \"%w\" (ts_ms);"
+
+// Schema version 1 stored local time as "YYYY-MM-DD hh:mm:ss.sss" text in date column.
+// Rows with unparsable dates are dropped during migration.
+#define CHECK_SCHEMA_V1_FQUERY "select date from \"%w\" limit 0;"
+#define MIGRATE_SCHEMA_V1_FQUERY                                                                             \
+    "create table \"%w_v2\""                                                                                 \
+    "(id integer primary key autoincrement,                                                                  \
+    ts_ms integer not null,                                                                                  \
+    temp float not null);"                                                                                   \
+    "insert into \"%w_v2\" (id, ts_ms, temp)"                                                                \
+    "  select id, cast(round((julianday(date, 'utc') - 2440587.5) * 86400000.0) as integer), temp"           \
+    "  from \"%w\" where julianday(date, 'utc') is not null;"                                                \
+    "drop table \"%w\";"                                                                                     \
+    "alter table \"%w_v2\" rename to \"%w\";"
 
 #define PRAGMA_WAL_QUERY "pragma journal_mode=WAL;"
+#define PRAGMA_SYNC_FULL_QUERY "pragma synchronous=FULL;"
+#define PRAGMA_SYNC_NORMAL_QUERY "pragma synchronous=NORMAL;"
+#define BEGIN_QUERY "begin immediate;"
+#define COMMIT_QUERY "commit;"
+#define ROLLBACK_QUERY "rollback;"
 
 #define BUSY_TIMEOUT_MS 1000
-#define MAX_QUERY_LEN 1024
+#define ARRAY_INIT_CAPACITY 64
+// Same as sqlite default for auto-checkpoint, done by hand to know when WAL is synced to database.
+#define WAL_CHECKPOINT_PAGES 1000
+
+typedef struct {
+    i64 ts_ms;
+    f64 temp;
+} PendingSample;
+
+/// Single connection shared by all the logs in the database.
+struct LogStorage {
+    sqlite3 *db;
+    const char *db_path;
+    bool is_new;
+    bool read_only;
+
+    sqlite3_stmt *begin_stmt;
+    sqlite3_stmt *commit_stmt;
+    sqlite3_stmt *rollback_stmt;
+
+    LogDurability durability;
+    LogStats stats;
+    f64 first_pending_secs; // Time of the oldest sample buffered in memory
+    bool in_batch;          // Batch was started with begin_log_batch
+    bool in_txn;            // Transaction is actually open
+    bool pending_in_txn;    // Pending samples are written in the open transaction
+    usize n_txn_samples;    // Samples written in the open transaction
+
+    Log *logs; // All the logs initialized in the storage
+};
 
 struct Log {
+    LogStorage *storage;
+    Log *next;
     sqlite3 *db;
     const char *table_name;
+
+    // Samples waiting for group commit.
+    PendingSample *pending;
+    usize n_pending;
+    usize pending_capacity;
+
+    // Statements are prepared once in init_log and reused through sqlite3_reset.
+    sqlite3_stmt *insert_stmt;
+    sqlite3_stmt *select_between_stmt;
+    sqlite3_stmt *delete_old_stmt;
+    sqlite3_stmt *select_version_stmt;
+    sqlite3_stmt *select_between_id_stmt;
+    sqlite3_stmt *select_last_time_stmt;
+};
+
+/// Steps the cached select statement of the log, then goes over samples waiting for group commit.
+struct LogCursor {
+    Log *log;
+    sqlite3_stmt *stmt; // NULL once all the rows are read
+    i64 ms_start;
+    i64 ms_end;
+    i64 after_id;      // Entries at ms_start with row id up to this one are skipped
+    i64 last_id;       // Row id of the entry read last, 0 for pending samples
+    usize pending_pos; // Next pending sample to check
 };
 
+static LogStorage *open_storage(const char *db_path, bool read_only);
 static int check_db_exist(const char *path);
-static void xprint_fquery(char *query, const char *format, ...);
-static int prepare_stmt(sqlite3 *db, const char *query, sqlite3_stmt **stmt);
-static void xexec_query(sqlite3 *db, char *query);
-static sqlite3_stmt *prepare_select_between_dates_stmt(Log *log, const DateTime *date_start,
-                                                       const DateTime *date_end);
-static i64 count_between_dates(Log *log, const DateTime *date_start, const DateTime *date_end);
+static int check_writable(const Log *log);
+static void migrate_schema_v1(sqlite3 *db, const char *table_name);
+static sqlite3_stmt *xprepare_stmt(sqlite3 *db, const char *query);
+static sqlite3_stmt *xprepare_fstmt(sqlite3 *db, const char *format, const char *table_name);
+static int step_once(sqlite3_stmt *stmt);
+static void reset_stmt(sqlite3_stmt *stmt);
+static void xexec_query(sqlite3 *db, const char *query);
+static void xexec_fquery(sqlite3 *db, const char *format, ...);
+static sqlite3_stmt *bind_between_ms_stmt(sqlite3_stmt *stmt, i64 ms_start, i64 ms_end, i64 after_id);
+static int grow_temp_array(TempArray *array, usize *capacity);
+static bool is_group_commit(const LogStorage *storage);
+static int begin_txn(LogStorage *storage);
+static int ensure_txn(LogStorage *storage);
+static int commit_txn(LogStorage *storage);
+static void rollback_txn(LogStorage *storage);
+static void account_committed(LogStorage *storage, usize n_samples);
+static void update_max_at_risk(LogStorage *storage);
+static int insert_sample(Log *log, i64 ts_ms, f64 value);
+static int push_pending(Log *log, i64 ts_ms, f64 value);
+static int write_pending(LogStorage *storage);
+static int wal_hook(void *storage, sqlite3 *db, const char *db_name, int n_pages);
+
+LogStorage *open_log_storage(const char db_path[])
+{
+    return open_storage(db_path, false);
+}
 
-// TODO: it would be better to accept one string in format like path/to/database.db:table_name
-Log *init_log(const char db_path[], const char table_name[])
+LogStorage *open_log_storage_readonly(const char db_path[])
 {
-    int res;
+    return open_storage(db_path, true);
+}
 
-    int exists = check_db_exist(db_path);
-    if (exists == -1) {
-        fprintf(stderr, "Failed to access database file: %s\n", db_path);
-        exit(1);
+int close_log_storage(LogStorage *storage)
+{
+    int res = 0;
+
+    if (storage->stats.pending > 0 && flush_log_storage(storage) == -1) {
+        fprintf(stderr, "Failed to flush %zu pending samples on close!\n", storage->stats.pending);
+        res = -1;
     }
 
-    Log *log = xmalloc(sizeof(Log));
-    res = sqlite3_open(db_path, &log->db);
-    if (res != SQLITE_OK) {
-        fprintf(stderr, "Failed to open database: %s (%d)\n", sqlite3_errmsg(log->db), res);
-        exit(1);
+    sqlite3_finalize(storage->begin_stmt);
+    sqlite3_finalize(storage->commit_stmt);
+    sqlite3_finalize(storage->rollback_stmt);
+
+    if (sqlite3_close(storage->db) != SQLITE_OK)
+        res = -1;
+    free(storage);
+    return res;
+}
+
+int set_log_durability(LogStorage *storage, const LogDurability *durability)
+{
+    if (storage->stats.pending > 0 && flush_log_storage(storage) == -1)
+        return -1;
+
+    const char *query =
+        durability->sync == LOG_SYNC_NORMAL ? PRAGMA_SYNC_NORMAL_QUERY : PRAGMA_SYNC_FULL_QUERY;
+    char *errmsg;
+    sqlite3_exec(storage->db, query, NULL, NULL, &errmsg);
+    if (errmsg != NULL) {
+        fprintf(stderr, "Failed to set synchronous mode: %s\n", errmsg);
+        sqlite3_free(errmsg);
+        return -1;
+    }
+
+    storage->durability = *durability;
+    return 0;
+}
+
+void get_log_stats(LogStorage *storage, LogStats *stats)
+{
+    *stats = storage->stats;
+}
+
+// The transaction itself is started lazily by the first write of the batch,
+// so a batch that only buffers samples for group commit costs nothing.
+int begin_log_batch(LogStorage *storage)
+{
+    storage->in_batch = true;
+    return 0;
+}
+
+int end_log_batch(LogStorage *storage)
+{
+    storage->in_batch = false;
+
+    f64 now = get_secs();
+    const LogDurability *d = &storage->durability;
+    bool is_due = storage->stats.pending > 0 &&
+                  ((d->commit_samples > 0 && storage->stats.pending >= d->commit_samples) ||
+                   (d->commit_period > 0 && now - storage->first_pending_secs >= d->commit_period));
+
+    // Commit of other writes is paid anyway, so pending samples are written along with them.
+    if ((is_due || storage->in_txn) && storage->stats.pending > 0)
+        return flush_log_storage(storage);
+
+    if (storage->in_txn)
+        return commit_txn(storage);
+    return 0;
+}
+
+int flush_log_storage(LogStorage *storage)
+{
+    if (begin_txn(storage) == -1)
+        return -1;
+
+    // Nothing is removed from memory until commit succeeds, so the failed samples are retried later.
+    if (write_pending(storage) == -1) {
+        rollback_txn(storage);
+        return -1;
     }
 
+    return commit_txn(storage);
+}
+
+Log *init_log(LogStorage *storage, const char table_name[])
+{
+    Log *log = xmalloc(sizeof(Log));
+    log->storage = storage;
+    log->db = storage->db;
     log->table_name = table_name;
+    log->pending = NULL;
+    log->n_pending = 0;
+    log->pending_capacity = 0;
+
+    log->next = storage->logs;
+    storage->logs = log;
+
+    if (storage->read_only) {
+        // Table has to be created by a writer already
+        log->select_between_stmt = xprepare_fstmt(log->db, SELECT_BETWEEN_DATE_FQUERY, table_name);
+        log->select_version_stmt = xprepare_fstmt(log->db, SELECT_VERSION_FQUERY, table_name);
+        log->select_between_id_stmt = xprepare_fstmt(log->db, SELECT_BETWEEN_ID_FQUERY, table_name);
+        log->select_last_time_stmt = xprepare_fstmt(log->db, SELECT_LAST_TIME_FQUERY, table_name);
+        log->insert_stmt = NULL;
+        log->delete_old_stmt = NULL;
+        return log;
+    }
 
-    char query_create[MAX_QUERY_LEN + 1];
-    xprint_fquery(query_create, CREATE_TABLE_FQUERY, log->table_name);
-    xexec_query(log->db, query_create);
-    if (!exists)
-        fprintf(stderr, "Created and initialized new table %s in database %s.\n", table_name, db_path);
+    migrate_schema_v1(log->db, table_name);
 
-    xexec_query(log->db, PRAGMA_WAL_QUERY);
+    xexec_fquery(log->db, CREATE_TABLE_FQUERY, table_name);
+    xexec_fquery(log->db, CREATE_INDEX_FQUERY, table_name, table_name);
+    if (storage->is_new)
+        fprintf(stderr, "Created and initialized new table %s in database %s.\n", table_name,
+                storage->db_path);
 
-    sqlite3_busy_timeout(log->db, BUSY_TIMEOUT_MS);
+    log->insert_stmt = xprepare_fstmt(log->db, INSERT_FQUERY, table_name);
+    log->select_between_stmt = xprepare_fstmt(log->db, SELECT_BETWEEN_DATE_FQUERY, table_name);
+    log->delete_old_stmt = xprepare_fstmt(log->db, DELETE_OLD_FQUERY, table_name);
+    log->select_version_stmt = xprepare_fstmt(log->db, SELECT_VERSION_FQUERY, table_name);
+    log->select_between_id_stmt = xprepare_fstmt(log->db, SELECT_BETWEEN_ID_FQUERY, table_name);
+    log->select_last_time_stmt = xprepare_fstmt(log->db, SELECT_LAST_TIME_FQUERY, table_name);
 
     return log;
 }
@@ -82,160 +287,298 @@ Log *init_log(const char db_path[], const char table_name[])
 int deinit_log(Log *log)
 {
     int res = 0;
-    if (sqlite3_close(log->db) != SQLITE_OK)
+    LogStorage *storage = log->storage;
+
+    if (log->n_pending > 0 && flush_log_storage(storage) == -1) {
+        fprintf(stderr, "Failed to flush pending samples of %s, they are lost!\n", log->table_name);
+        storage->stats.pending -= log->n_pending;
         res = -1;
+    }
+
+    for (Log **l = &storage->logs; *l != NULL; l = &(*l)->next) {
+        if (*l == log) {
+            *l = log->next;
+            break;
+        }
+    }
+
+    sqlite3_finalize(log->insert_stmt);
+    sqlite3_finalize(log->select_between_stmt);
+    sqlite3_finalize(log->delete_old_stmt);
+    sqlite3_finalize(log->select_version_stmt);
+    sqlite3_finalize(log->select_between_id_stmt);
+    sqlite3_finalize(log->select_last_time_stmt);
+
+    free(log->pending);
     free(log);
     return res;
 }
 
-int write_log(Log *log, f64 value, DateTime *date, usize max_period)
+int write_log(Log *log, f64 value, i64 unix_ms, usize max_period)
 {
-    int res;
-    char date_str[DATE_LEN + 1];
-    print_date(date_str, date);
-
-    if (delete_old_entries(log, date, max_period) == -1)
-        fprintf(stderr, "Failed to delete old entries\n");
-
-    char query[MAX_QUERY_LEN + 1];
-    xprint_fquery(query, INSERT_FQUERY, log->table_name, date_str, value);
+    (void)max_period; // Retention is done separately by delete_old_entries
 
-    sqlite3_stmt *stmt;
-    if (prepare_stmt(log->db, query, &stmt) == -1)
+    if (check_writable(log) == -1)
         return -1;
+    if (is_group_commit(log->storage))
+        return push_pending(log, unix_ms, value);
 
-    res = sqlite3_step(stmt);
-    if (res != SQLITE_DONE) {
-        fprintf(stderr, "Failed to insert into database: %s (%d)\n", sqlite3_errstr(res), res);
+    LogStorage *storage = log->storage;
+    if (ensure_txn(storage) == -1 || insert_sample(log, unix_ms, value) == -1)
         return -1;
-    }
 
-    sqlite3_finalize(stmt);
+    if (storage->in_txn)
+        storage->n_txn_samples++;
+    else
+        account_committed(storage, 1);
     return 0;
 }
 
-f64 get_avg_log(Log *log, f64 period, DateTime *date)
+f64 get_avg_log(Log *log, f64 period, i64 unix_ms)
 {
-    DateTime date_start;
-    get_datetime_from_secs(&date_start, to_secs(date) - period);
+    i64 ms_end = unix_ms;
+    i64 ms_start = ms_end - (i64)(period * 1000);
 
-    sqlite3_stmt *stmt = prepare_select_between_dates_stmt(log, &date_start, date);
-    if (stmt == NULL)
-        return INFINITY;
+    sqlite3_stmt *stmt = bind_between_ms_stmt(log->select_between_stmt, ms_start, ms_end, INT64_MIN);
 
     f64 sum = 0;
     usize ctr = 0;
     for (int res = sqlite3_step(stmt); res != SQLITE_DONE; res = sqlite3_step(stmt)) {
         if (res != SQLITE_ROW) {
             fprintf(stderr, "Failed to obtain database entry: %s (%d)\n", sqlite3_errstr(res), res);
+            reset_stmt(stmt);
             return INFINITY;
         }
         sum += sqlite3_column_double(stmt, 1);
         ctr++;
     }
-    sqlite3_finalize(stmt);
+    reset_stmt(stmt);
+
+    for (usize i = 0; i < log->n_pending; i++) {
+        if (log->pending[i].ts_ms >= ms_start && log->pending[i].ts_ms <= ms_end) {
+            sum += log->pending[i].temp;
+            ctr++;
+        }
+    }
     return sum / ctr;
 }
 
-int delete_old_entries(Log *log, DateTime *date, usize max_period)
+int delete_old_entries(Log *log, i64 unix_ms, usize max_period)
 {
-    char query_select[MAX_QUERY_LEN + 1];
-    xprint_fquery(query_select, SELECT_BY_ID_FQUERY, log->table_name);
-
-    sqlite3_stmt *stmt_select;
-    if (prepare_stmt(log->db, query_select, &stmt_select) == -1)
+    // One set-based delete over the ts_ms index, executed as a single transaction.
+    if (check_writable(log) == -1 || ensure_txn(log->storage) == -1)
         return -1;
 
-    // This thing evaluates lazily and we exit after first "new" entry,
-    // so it's amortized O(1) actually.
-    for (int res = sqlite3_step(stmt_select); res != SQLITE_DONE; res = sqlite3_step(stmt_select)) {
-        if (res != SQLITE_ROW) {
-            fprintf(stderr, "Failed to obtain database entry: %s (%d)\n", sqlite3_errstr(res), res);
-            return -1;
-        }
-        const u8 *date_str = sqlite3_column_text(stmt_select, 1);
-        bool is_ascii = !is_valid_ascii(date_str);
-        bool is_old = false;
-        if (!is_ascii) {
-            fprintf(stderr, "Non ASCII characters in date column! Deleting entry...\n");
-        } else {
-            DateTime date_entry;
-            scan_date((char *)date_str, &date_entry);
-            is_old = to_secs(date) - to_secs(&date_entry) > max_period;
-        }
+    sqlite3_stmt *stmt = log->delete_old_stmt;
+    sqlite3_bind_int64(stmt, 1, unix_ms - (i64)max_period * 1000);
 
-        if (!is_ascii || is_old) {
-            int id = sqlite3_column_int(stmt_select, 0);
-            char query_del[MAX_QUERY_LEN + 1];
-            xprint_fquery(query_del, DELETE_BY_ID_FQUERY, log->table_name, id);
-
-            char *errmsg;
-            sqlite3_exec(log->db, query_del, NULL, NULL, &errmsg);
-            if (errmsg != NULL) {
-                fprintf(stderr, "Failed to delete entry from database with query '%s': %s", query_del,
-                        errmsg);
-                sqlite3_free(errmsg);
-            }
-        } else {
-            // If we encountered at least one entry which is neither old nor invalid, we can stop here.
-            break;
-        }
+    int res = sqlite3_step(stmt);
+    reset_stmt(stmt);
+    if (res != SQLITE_DONE) {
+        fprintf(stderr, "Failed to delete old entries from database: %s (%d)\n", sqlite3_errstr(res), res);
+        return -1;
     }
-    sqlite3_finalize(stmt_select);
     return 0;
 }
 
-TempArray *get_array_entries(Log *log, const DateTime *date_start, const DateTime *date_end)
+TempArray *get_array_entries(Log *log, i64 start_ms, i64 end_ms)
 {
-    if (date_start == NULL)
-        date_start = &FIRST_DATE;
-
-    if (date_end == NULL)
-        date_end = &LAST_DATE;
-
-    i64 n = count_between_dates(log, date_start, date_end);
-    if (n == -1)
+    LogCursor *cursor = open_log_cursor(log, start_ms, end_ms);
+    if (cursor == NULL)
         return NULL;
 
     TempArray *array = xmalloc(sizeof(TempArray));
-    array->items = malloc(sizeof(TempEntry) * n);
-    if (array->items == NULL) {
-        fprintf(stderr, "Failed to allocate memory for TempArray of size %zd: %s (%d)\n", n, strerror(errno),
-                errno);
+    array->items = NULL;
+    array->size = 0;
+    usize capacity = 0;
+
+    // Single pass over the range: the buffer grows geometrically instead of being sized by count query,
+    // so rows committed while stepping can't overrun it.
+    TempEntry entry;
+    int res;
+    while ((res = next_log_entry(cursor, &entry)) == 1) {
+        if (array->size == capacity && grow_temp_array(array, &capacity) == -1) {
+            res = -1;
+            break;
+        }
+        array->items[array->size++] = entry;
+    }
+    close_log_cursor(cursor);
+
+    if (res == -1) {
+        free(array->items);
         free(array);
         return NULL;
     }
-    array->size = n;
+    return array;
+}
+
+int get_log_version(Log *log, LogVersion *version)
+{
+    sqlite3_stmt *stmt = log->select_version_stmt;
+    int res = sqlite3_step(stmt);
+    if (res != SQLITE_ROW) {
+        fprintf(stderr, "Failed to get version of %s: %s (%d)\n", log->table_name, sqlite3_errstr(res), res);
+        reset_stmt(stmt);
+        return -1;
+    }
 
-    sqlite3_stmt *stmt = prepare_select_between_dates_stmt(log, date_start, date_end);
-    if (stmt == NULL)
-        goto error;
+    // Empty table has null ids, which are read as 0
+    version->min_id = sqlite3_column_int64(stmt, 0);
+    version->max_id = sqlite3_column_int64(stmt, 1);
+    reset_stmt(stmt);
+    return 0;
+}
 
-    usize i = 0;
-    for (int res = sqlite3_step(stmt); res != SQLITE_DONE; res = sqlite3_step(stmt), i++) {
-        if (res != SQLITE_ROW) {
+int get_last_log_time(Log *log, i64 *unix_ms)
+{
+    sqlite3_stmt *stmt = log->select_last_time_stmt;
+    int res = sqlite3_step(stmt);
+    if (res != SQLITE_ROW) {
+        fprintf(stderr, "Failed to get last time of %s: %s (%d)\n", log->table_name, sqlite3_errstr(res),
+                res);
+        reset_stmt(stmt);
+        return -1;
+    }
+
+    bool is_empty = sqlite3_column_type(stmt, 0) == SQLITE_NULL;
+    *unix_ms = sqlite3_column_int64(stmt, 0);
+    reset_stmt(stmt);
+    return is_empty ? 0 : 1;
+}
+
+LogCursor *open_log_cursor(Log *log, i64 start_ms, i64 end_ms)
+{
+    return open_log_cursor_after(log, start_ms, INT64_MIN, end_ms);
+}
+
+LogCursor *open_log_cursor_after(Log *log, i64 after_ms, i64 after_id, i64 end_ms)
+{
+    LogCursor *cursor = xmalloc(sizeof(LogCursor));
+    cursor->log = log;
+    cursor->ms_start = after_ms;
+    cursor->ms_end = end_ms;
+    cursor->after_id = after_id;
+    cursor->last_id = 0;
+    cursor->stmt = bind_between_ms_stmt(log->select_between_stmt, after_ms, end_ms, after_id);
+    cursor->pending_pos = 0;
+    return cursor;
+}
+
+LogCursor *open_log_cursor_by_id(Log *log, i64 after_id, i64 last_id)
+{
+    LogCursor *cursor = xmalloc(sizeof(LogCursor));
+    cursor->log = log;
+    cursor->ms_start = INT64_MIN;
+    cursor->ms_end = INT64_MAX;
+    cursor->after_id = INT64_MIN;
+    cursor->last_id = 0;
+    cursor->stmt = log->select_between_id_stmt;
+    sqlite3_bind_int64(cursor->stmt, 1, after_id);
+    sqlite3_bind_int64(cursor->stmt, 2, last_id);
+    cursor->pending_pos = log->n_pending; // Pending samples have no ids yet
+    return cursor;
+}
+
+int next_log_entry(LogCursor *cursor, TempEntry *entry)
+{
+    if (cursor->stmt != NULL) {
+        int res = sqlite3_step(cursor->stmt);
+        if (res == SQLITE_ROW) {
+            entry->ts_ms = sqlite3_column_int64(cursor->stmt, 0);
+            entry->temp = sqlite3_column_double(cursor->stmt, 1);
+            cursor->last_id = sqlite3_column_int64(cursor->stmt, 2);
+            return 1;
+        }
+
+        reset_stmt(cursor->stmt);
+        cursor->stmt = NULL;
+        if (res != SQLITE_DONE) {
             fprintf(stderr, "Failed to obtain database entry: %s (%d)\n", sqlite3_errstr(res), res);
-            goto error;
+            return -1;
         }
+    }
 
-        const u8 *date_str = sqlite3_column_text(stmt, 0);
-        if (!is_valid_ascii(date_str) || scan_date((const char *)date_str, &array->items[i].date) == -1) {
-            fprintf(stderr, "WARN: Invalid entry found in date column! %s\n", date_str);
-            array->items[i] = (TempEntry){0};
+    // Samples waiting for group commit are newer than any committed one, they have no row ids yet and get 0
+    const Log *log = cursor->log;
+    while (cursor->pending_pos < log->n_pending) {
+        const PendingSample *sample = &log->pending[cursor->pending_pos++];
+        if (sample->ts_ms < cursor->ms_start || sample->ts_ms > cursor->ms_end ||
+            (sample->ts_ms == cursor->ms_start && cursor->after_id >= 0))
             continue;
-        }
 
-        array->items[i].temp = sqlite3_column_double(stmt, 1);
+        entry->ts_ms = sample->ts_ms;
+        entry->temp = sample->temp;
+        cursor->last_id = 0;
+        return 1;
     }
+    return 0;
+}
 
-end:
-    sqlite3_finalize(stmt);
-    return array;
-error:
-    free(array->items);
-    free(array);
-    array = NULL;
-    goto end;
+i64 get_log_cursor_id(const LogCursor *cursor)
+{
+    return cursor->last_id;
+}
+
+void close_log_cursor(LogCursor *cursor)
+{
+    if (cursor->stmt != NULL)
+        reset_stmt(cursor->stmt);
+    free(cursor);
+}
+
+/// Open the database connection and initialize storage state.
+/// Read-only connection doesn't touch journal mode or WAL hook, those are owned by the writer.
+/// It is used by a single thread, so sqlite mutexes are not needed.
+static LogStorage *open_storage(const char *db_path, bool read_only)
+{
+    int exists = check_db_exist(db_path);
+    if (exists == -1) {
+        fprintf(stderr, "Failed to access database file: %s\n", db_path);
+        exit(1);
+    }
+
+    int flags = read_only ? SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX
+                          : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    LogStorage *storage = xmalloc(sizeof(LogStorage));
+    int res = sqlite3_open_v2(db_path, &storage->db, flags, NULL);
+    if (res != SQLITE_OK) {
+        fprintf(stderr, "Failed to open database: %s (%d)\n", sqlite3_errmsg(storage->db), res);
+        exit(1);
+    }
+
+    storage->db_path = db_path;
+    storage->is_new = !exists;
+    storage->read_only = read_only;
+
+    sqlite3_busy_timeout(storage->db, BUSY_TIMEOUT_MS);
+
+    if (read_only) {
+        storage->begin_stmt = NULL;
+        storage->commit_stmt = NULL;
+        storage->rollback_stmt = NULL;
+    } else {
+        xexec_query(storage->db, PRAGMA_WAL_QUERY);
+
+        storage->begin_stmt = xprepare_stmt(storage->db, BEGIN_QUERY);
+        storage->commit_stmt = xprepare_stmt(storage->db, COMMIT_QUERY);
+        storage->rollback_stmt = xprepare_stmt(storage->db, ROLLBACK_QUERY);
+    }
+
+    storage->durability = (LogDurability){.commit_samples = 1, .commit_period = 0, .sync = LOG_SYNC_FULL};
+    storage->stats = (LogStats){0};
+    storage->first_pending_secs = 0;
+    storage->in_batch = false;
+    storage->in_txn = false;
+    storage->pending_in_txn = false;
+    storage->n_txn_samples = 0;
+    storage->logs = NULL;
+
+    // Replaces sqlite auto-checkpoint, which is also implemented as WAL hook.
+    if (!read_only)
+        sqlite3_wal_hook(storage->db, wal_hook, storage);
+
+    return storage;
 }
 
 /// Return -1 on error, boolean otherwise
@@ -256,35 +599,86 @@ static int check_db_exist(const char *path)
     return res;
 }
 
-/// Try to print formatted query, exit if query is too long.
-__attribute__((format(printf, 2, 3))) //
-static void xprint_fquery(char *query, const char *format, ...)
+/// Return 0 if the log can be written to, -1 if its storage is read-only.
+static int check_writable(const Log *log)
 {
-    va_list args;
-    va_start(args, format);
+    if (!log->storage->read_only)
+        return 0;
+    fprintf(stderr, "Failed to write to table %s: storage is opened read-only!\n", log->table_name);
+    return -1;
+}
+
+/// Convert table from schema version 1 to the current one, if needed.
+/// Check and conversion are done in one write transaction, so concurrent processes migrate it only once.
+/// Exit on fail.
+static void migrate_schema_v1(sqlite3 *db, const char *table_name)
+{
+    xexec_query(db, "begin immediate;");
 
-    int res = vsnprintf(query, MAX_QUERY_LEN + 1, format, args);
-    if (res >= MAX_QUERY_LEN + 1) {
-        fprintf(stderr, "Data string representation is too long, can't fit in query! Query: '%s'\n", query);
+    char *query = sqlite3_mprintf(CHECK_SCHEMA_V1_FQUERY, table_name);
+    if (query == NULL) {
+        fprintf(stderr, "Failed to allocate memory for query!\n");
         exit(1);
     }
+    sqlite3_stmt *stmt;
+    bool is_v1 = sqlite3_prepare_v2(db, query, -1, &stmt, NULL) == SQLITE_OK;
+    sqlite3_finalize(stmt);
+    sqlite3_free(query);
 
-    va_end(args);
+    if (is_v1) {
+        fprintf(stderr, "Migrating table %s to integer timestamps...\n", table_name);
+        xexec_fquery(db, MIGRATE_SCHEMA_V1_FQUERY, table_name, table_name, table_name, table_name, table_name,
+                     table_name);
+    }
+
+    xexec_query(db, "commit;");
 }
 
-static int prepare_stmt(sqlite3 *db, const char *query, sqlite3_stmt **stmt)
+/// Prepare long-living statement, exit on fail.
+static sqlite3_stmt *xprepare_stmt(sqlite3 *db, const char *query)
 {
-    int res = sqlite3_prepare_v2(db, query, -1, stmt, NULL);
+    sqlite3_stmt *stmt;
+    int res = sqlite3_prepare_v3(db, query, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
     if (res != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement for query '%s': %s (%d)", query, sqlite3_errstr(res),
+        fprintf(stderr, "Failed to prepare statement for query '%s': %s (%d)\n", query, sqlite3_errmsg(db),
                 res);
-        return -1;
+        exit(1);
     }
-    return 0;
+    return stmt;
+}
+
+/// Prepare statement for query format with substituted table name, exit on fail.
+static sqlite3_stmt *xprepare_fstmt(sqlite3 *db, const char *format, const char *table_name)
+{
+    char *query = sqlite3_mprintf(format, table_name);
+    if (query == NULL) {
+        fprintf(stderr, "Failed to allocate memory for query!\n");
+        exit(1);
+    }
+
+    sqlite3_stmt *stmt = xprepare_stmt(db, query);
+    sqlite3_free(query);
+    return stmt;
+}
+
+/// Reset cached statement so it can be reused, dropping all the bound values.
+static void reset_stmt(sqlite3_stmt *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+/// Step cached statement without result rows and reset it.
+/// Return sqlite result code of the step.
+static int step_once(sqlite3_stmt *stmt)
+{
+    int res = sqlite3_step(stmt);
+    reset_stmt(stmt);
+    return res;
 }
 
 /// Execute provided statement or exit on fail
-static void xexec_query(sqlite3 *db, char *query)
+static void xexec_query(sqlite3 *db, const char *query)
 {
     char *errmsg;
     sqlite3_exec(db, query, NULL, NULL, &errmsg);
@@ -294,56 +688,200 @@ static void xexec_query(sqlite3 *db, char *query)
     }
 }
 
-/// Prepare statement, selecting all the entries in range of the given dates.
-/// Caller is responsible for memory freeing.
-/// Return NULL on error.
-static sqlite3_stmt *prepare_select_between_dates_stmt(Log *log, const DateTime *date_start,
-                                                       const DateTime *date_end)
+/// Format query with sqlite3_mprintf and execute it, exit on fail.
+static void xexec_fquery(sqlite3 *db, const char *format, ...)
 {
-    char date_start_str[DATE_LEN + 1], date_end_str[DATE_LEN + 1];
-    print_date(date_start_str, date_start);
-    print_date(date_end_str, date_end);
-
-    char query[MAX_QUERY_LEN + 1];
-    xprint_fquery(query, SELECT_BETWEEN_DATE_FQUERY, log->table_name, date_start_str, date_end_str);
+    va_list args;
+    va_start(args, format);
+    char *query = sqlite3_vmprintf(format, args);
+    va_end(args);
 
-    sqlite3_stmt *stmt;
-    int res = prepare_stmt(log->db, query, &stmt);
-    if (res == -1) {
-        fprintf(stderr, "Failed to prepare database statement with query \"%s\": %s (%d)\n", query,
-                sqlite3_errstr(res), res);
-        return NULL;
+    if (query == NULL) {
+        fprintf(stderr, "Failed to allocate memory for query!\n");
+        exit(1);
     }
+    xexec_query(db, query);
+    sqlite3_free(query);
+}
+
+/// Bind millisecond range to cached statement, selecting entries in range of the given timestamps,
+/// except the ones at ms_start with row id up to after_id, INT64_MIN to select all of them.
+/// Statement must be reset with reset_stmt after use.
+static sqlite3_stmt *bind_between_ms_stmt(sqlite3_stmt *stmt, i64 ms_start, i64 ms_end, i64 after_id)
+{
+    sqlite3_bind_int64(stmt, 1, ms_start);
+    sqlite3_bind_int64(stmt, 2, ms_end);
+    sqlite3_bind_int64(stmt, 3, after_id);
     return stmt;
 }
 
-static int count_callback(void *count, int n_cols, char **entries, char **col_names)
+/// Double capacity of the array items buffer.
+/// Return 0 on success, -1 on error, array is left untouched on error.
+static int grow_temp_array(TempArray *array, usize *capacity)
 {
-    (void)col_names;
-    assert(n_cols == 1);
-    *(i64 *)count = atoll(entries[0]);
+    usize new_capacity = *capacity == 0 ? ARRAY_INIT_CAPACITY : *capacity * 2;
+    TempEntry *items = realloc(array->items, sizeof(TempEntry) * new_capacity);
+    if (items == NULL) {
+        fprintf(stderr, "Failed to allocate memory for TempArray of size %zu: %s (%d)\n", new_capacity,
+                strerror(errno), errno);
+        return -1;
+    }
+    array->items = items;
+    *capacity = new_capacity;
     return 0;
 }
 
-/// Count entries between provided dates.
-/// Return -1 on error, amount of entries otherwise.
-static i64 count_between_dates(Log *log, const DateTime *date_start, const DateTime *date_end)
+static bool is_group_commit(const LogStorage *storage)
 {
-    char date_start_str[DATE_LEN + 1], date_end_str[DATE_LEN + 1];
-    print_date(date_start_str, date_start);
-    print_date(date_end_str, date_end);
+    return storage->durability.commit_samples > 1 || storage->durability.commit_period > 0;
+}
 
-    char count_query[MAX_QUERY_LEN + 1];
-    xprint_fquery(count_query, COUNT_BETWEEN_DATE_FQUERY, log->table_name, date_start_str, date_end_str);
+/// Start transaction if it isn't started yet.
+/// Return 0 on success, -1 on error.
+static int begin_txn(LogStorage *storage)
+{
+    if (storage->in_txn)
+        return 0;
 
-    char *errmsg;
-    i64 count;
-    sqlite3_exec(log->db, count_query, &count_callback, &count, &errmsg);
-    if (errmsg != NULL) {
-        fprintf(stderr, "Failed to count amount of entries with query \"%s\": %s\n", count_query, errmsg);
-        sqlite3_free(errmsg);
+    int res = step_once(storage->begin_stmt);
+    if (res != SQLITE_DONE) {
+        fprintf(stderr, "Failed to begin transaction: %s (%d)\n", sqlite3_errstr(res), res);
+        return -1;
+    }
+    storage->in_txn = true;
+    return 0;
+}
+
+/// Start transaction if batch is open, otherwise every statement is committed on its own.
+/// Return 0 on success, -1 on error.
+static int ensure_txn(LogStorage *storage)
+{
+    return storage->in_batch ? begin_txn(storage) : 0;
+}
+
+/// Commit open transaction or roll it back on error.
+/// Pending samples written in transaction are removed from memory on success.
+/// Return 0 on success, -1 on error.
+static int commit_txn(LogStorage *storage)
+{
+    int res = step_once(storage->commit_stmt);
+    if (res != SQLITE_DONE) {
+        fprintf(stderr, "Failed to commit transaction: %s (%d)\n", sqlite3_errstr(res), res);
+        rollback_txn(storage);
+        return -1;
+    }
+    storage->in_txn = false;
+
+    if (storage->pending_in_txn) {
+        for (Log *log = storage->logs; log != NULL; log = log->next)
+            log->n_pending = 0;
+        storage->stats.pending = 0;
+        storage->pending_in_txn = false;
+    }
+
+    account_committed(storage, storage->n_txn_samples);
+    storage->n_txn_samples = 0;
+    return 0;
+}
+
+/// Roll back open transaction, pending samples stay in memory.
+static void rollback_txn(LogStorage *storage)
+{
+    if (!sqlite3_get_autocommit(storage->db))
+        step_once(storage->rollback_stmt);
+    storage->in_txn = false;
+    storage->pending_in_txn = false;
+    storage->n_txn_samples = 0;
+}
+
+static void account_committed(LogStorage *storage, usize n_samples)
+{
+    if (n_samples == 0)
+        return;
+
+    storage->stats.commits++;
+    storage->stats.committed += n_samples;
+    // Might be already checkpointed by the WAL hook during commit, so it's an upper bound.
+    if (storage->durability.sync == LOG_SYNC_NORMAL)
+        storage->stats.unsynced += n_samples;
+    update_max_at_risk(storage);
+}
+
+static void update_max_at_risk(LogStorage *storage)
+{
+    usize at_risk = storage->stats.pending + storage->stats.unsynced;
+    if (at_risk > storage->stats.max_at_risk)
+        storage->stats.max_at_risk = at_risk;
+}
+
+/// Insert sample into log table right away.
+/// Return 0 on success, -1 on error.
+static int insert_sample(Log *log, i64 ts_ms, f64 value)
+{
+    sqlite3_stmt *stmt = log->insert_stmt;
+    sqlite3_bind_int64(stmt, 1, ts_ms);
+    sqlite3_bind_double(stmt, 2, value);
+
+    int res = step_once(stmt);
+    if (res != SQLITE_DONE) {
+        fprintf(stderr, "Failed to insert into database: %s (%d)\n", sqlite3_errstr(res), res);
         return -1;
     }
+    return 0;
+}
+
+/// Buffer sample in memory until group commit.
+/// Return 0 on success, -1 on error.
+static int push_pending(Log *log, i64 ts_ms, f64 value)
+{
+    if (log->n_pending == log->pending_capacity) {
+        usize new_capacity = log->pending_capacity == 0 ? ARRAY_INIT_CAPACITY : log->pending_capacity * 2;
+        PendingSample *pending = realloc(log->pending, sizeof(PendingSample) * new_capacity);
+        if (pending == NULL) {
+            fprintf(stderr, "Failed to allocate memory for %zu pending samples: %s (%d)\n", new_capacity,
+                    strerror(errno), errno);
+            return -1;
+        }
+        log->pending = pending;
+        log->pending_capacity = new_capacity;
+    }
+
+    LogStorage *storage = log->storage;
+    if (storage->stats.pending == 0)
+        storage->first_pending_secs = get_secs();
+
+    log->pending[log->n_pending++] = (PendingSample){.ts_ms = ts_ms, .temp = value};
+    storage->stats.pending++;
+    update_max_at_risk(storage);
+    return 0;
+}
+
+/// Insert all the pending samples of the storage into their tables, transaction must be open.
+/// Return 0 on success, -1 on error.
+static int write_pending(LogStorage *storage)
+{
+    for (Log *log = storage->logs; log != NULL; log = log->next) {
+        for (usize i = 0; i < log->n_pending; i++) {
+            if (insert_sample(log, log->pending[i].ts_ms, log->pending[i].temp) == -1)
+                return -1;
+        }
+    }
+    storage->pending_in_txn = true;
+    storage->n_txn_samples += storage->stats.pending;
+    return 0;
+}
 
-    return count;
+/// Checkpoint WAL after commit, same as sqlite auto-checkpoint does.
+/// With synchronous=NORMAL commits reach the disk only here, so unsynced counter is reset.
+static int wal_hook(void *arg, sqlite3 *db, const char *db_name, int n_pages)
+{
+    LogStorage *storage = arg;
+    if (n_pages < WAL_CHECKPOINT_PAGES)
+        return SQLITE_OK;
+
+    int n_log, n_ckpt;
+    int res = sqlite3_wal_checkpoint_v2(db, db_name, SQLITE_CHECKPOINT_PASSIVE, &n_log, &n_ckpt);
+    if (res == SQLITE_OK && n_log == n_ckpt)
+        storage->stats.unsynced = 0;
+    return SQLITE_OK;
 }
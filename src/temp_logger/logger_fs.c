@@ -26,28 +26,182 @@
 #define LOG_LINE_LEN (DATE_LEN + MSG_LEN + 3)
 
 #define READ_BUF_SIZE 1024
+#define PENDING_INIT_CAPACITY 64
+
+typedef struct {
+    i64 ts_ms;
+    f64 temp;
+    usize max_period;
+} PendingSample;
+
+/// Directory with log files, every log is a separate file.
+struct LogStorage {
+    const char *log_dir;
+    bool read_only;
+
+    LogDurability durability;
+    LogStats stats;
+    f64 first_pending_secs; // Time of the oldest sample buffered in memory
+
+    Log *logs; // All the logs initialized in the storage
+};
 
 struct Log {
+    LogStorage *storage;
+    Log *next;
     FILE *file;
 
     f64 first_entry_time;
+
+    // Samples waiting for group commit.
+    PendingSample *pending;
+    usize n_pending;
+    usize pending_capacity;
 };
 
+/// Place in the ring where the next line goes, saved to undo lines that failed to flush.
+typedef struct {
+    i64 pos;
+    i64 size;
+    f64 first_entry_time;
+} RingPosition;
+
+/// Reads the file from the current position to the end, where the oldest lines are, then from the start
+/// up to the position. The position is restored on close.
+struct LogCursor {
+    Log *log;
+    i64 start_pos;
+    i64 size;
+    bool is_wrapped; // Reading from the start of the file
+    i64 start_ms;
+    i64 end_ms;
+    i64 after_id; // Lines at start_ms with number up to this one are skipped
+
+    // Lines have no row ids, so lines of the same time are numbered from 1 in file order instead
+    i64 last_ms;
+    i64 last_id;
+};
+
+static LogStorage *open_storage(const char *log_dir, bool read_only);
+static int check_writable(const Log *log);
+static int write_line(Log *log, f64 value, i64 ts_ms, usize max_period);
+static void save_ring_position(Log *log, RingPosition *ring);
+static int restore_ring_position(Log *log, const RingPosition *ring);
 static int swap_file_parts(FILE *file);
 static f64 first_entry_secs(FILE *file);
 
-Log *init_log(const char log_dir[], const char log_file[])
+LogStorage *open_log_storage(const char log_dir[])
 {
-    char *log_path = join_paths_xmalloc(log_dir, log_file);
+    return open_storage(log_dir, false);
+}
+
+LogStorage *open_log_storage_readonly(const char log_dir[])
+{
+    return open_storage(log_dir, true);
+}
+
+int close_log_storage(LogStorage *storage)
+{
+    int res = 0;
+    if (storage->stats.pending > 0)
+        res = flush_log_storage(storage);
+    free(storage);
+    return res;
+}
+
+int set_log_durability(LogStorage *storage, const LogDurability *durability)
+{
+    if (storage->stats.pending > 0 && flush_log_storage(storage) == -1)
+        return -1;
+    storage->durability = *durability;
+    return 0;
+}
+
+void get_log_stats(LogStorage *storage, LogStats *stats)
+{
+    *stats = storage->stats;
+}
+
+// Every line is written to its file right away or buffered for group commit, so there is no transaction.
+int begin_log_batch(LogStorage *storage)
+{
+    (void)storage;
+    return 0;
+}
+
+int end_log_batch(LogStorage *storage)
+{
+    const LogDurability *d = &storage->durability;
+    bool is_due = storage->stats.pending > 0 &&
+                  ((d->commit_samples > 0 && storage->stats.pending >= d->commit_samples) ||
+                   (d->commit_period > 0 && get_secs() - storage->first_pending_secs >= d->commit_period));
+    return is_due ? flush_log_storage(storage) : 0;
+}
+
+int flush_log_storage(LogStorage *storage)
+{
+    int res = 0;
+    usize n_committed = 0;
+    for (Log *log = storage->logs; log != NULL; log = log->next) {
+        if (log->n_pending == 0)
+            continue;
+
+        RingPosition ring;
+        save_ring_position(log, &ring);
+        usize n_written = 0;
+        while (n_written < log->n_pending) {
+            PendingSample *sample = &log->pending[n_written];
+            if (write_line(log, sample->temp, sample->ts_ms, sample->max_period) == -1)
+                break;
+            n_written++;
+        }
+        if (n_written < log->n_pending)
+            res = -1;
+
+        if (fflush(log->file) == EOF) {
+            res = -1;
+            // Back to the ring position before the lines, so that all of them are written again in place
+            if (restore_ring_position(log, &ring) == 0)
+                continue;
+            // Lines stay in the stream buffer and go out with the next flush, so they are not queued again
+        }
+
+        log->n_pending -= n_written;
+        memmove(log->pending, log->pending + n_written, sizeof(PendingSample) * log->n_pending);
+        n_committed += n_written;
+    }
+
+    if (n_committed > 0) {
+        storage->stats.commits++;
+        storage->stats.committed += n_committed;
+        storage->stats.pending -= n_committed;
+    }
+    return res;
+}
+
+Log *init_log(LogStorage *storage, const char log_file[])
+{
+    char *log_path = join_paths_xmalloc(storage->log_dir, log_file);
 
     Log *log = xmalloc(sizeof(Log));
+    log->storage = storage;
+    log->pending = NULL;
+    log->n_pending = 0;
+    log->pending_capacity = 0;
 
-    // Create log without overwriting it if it exists.
-    // "a+" is the only way to do so, but it doesn't allow to overwrite written data later,
-    log->file = xfopen(log_path, "a+");
-    fclose(log->file);
-    // so we have to reopen file with "r+".
-    log->file = xfopen(log_path, "rb+");
+    log->next = storage->logs;
+    storage->logs = log;
+
+    if (storage->read_only) {
+        log->file = xfopen(log_path, "rb");
+    } else {
+        // Create log without overwriting it if it exists.
+        // "a+" is the only way to do so, but it doesn't allow to overwrite written data later,
+        log->file = xfopen(log_path, "a+");
+        fclose(log->file);
+        // so we have to reopen file with "r+".
+        log->file = xfopen(log_path, "rb+");
+    }
 
     if (fsize(log->file) == 0) {
         log->first_entry_time = -INFINITY;
@@ -69,7 +223,20 @@ Log *init_log(const char log_dir[], const char log_file[])
 
 int deinit_log(Log *log)
 {
-    int res1 = swap_file_parts(log->file);
+    LogStorage *storage = log->storage;
+    if (log->n_pending > 0 && flush_log_storage(storage) == -1) {
+        fprintf(stderr, "Failed to write pending samples of log on exit!\n");
+        storage->stats.pending -= log->n_pending;
+    }
+
+    for (Log **l = &storage->logs; *l != NULL; l = &(*l)->next) {
+        if (*l == log) {
+            *l = log->next;
+            break;
+        }
+    }
+
+    int res1 = storage->read_only ? 0 : swap_file_parts(log->file);
     if (res1 == -1)
         perror("Failed to sort log on exit");
 
@@ -77,39 +244,62 @@ int deinit_log(Log *log)
     if (res2 == -1)
         perror("Failed to close log on exit");
 
+    free(log->pending);
     free(log);
 
     return (res1 == 0 && res2 == 0) ? 0 : -1;
 }
 
-int write_log(Log *log, f64 value, DateTime *date, usize max_period)
+int write_log(Log *log, f64 value, i64 unix_ms, usize max_period)
 {
-    time_t secs = to_secs(date);
-    int at_end = fatend(log->file);
-    if (at_end == -1) {
-        fprintf(stderr, "No longer able to access log file! %s (%d)\n", strerror(errno), errno);
+    if (check_writable(log) == -1)
         return -1;
-    }
-    if (at_end && secs - log->first_entry_time > max_period) {
-        rewind(log->file);
-        log->first_entry_time = secs;
+
+    LogStorage *storage = log->storage;
+    if (storage->durability.commit_samples <= 1 && storage->durability.commit_period == 0) {
+        RingPosition ring;
+        save_ring_position(log, &ring);
+        if (write_line(log, value, unix_ms, max_period) == -1)
+            return -1;
+        if (fflush(log->file) == EOF) {
+            restore_ring_position(log, &ring);
+            return -1;
+        }
+        storage->stats.commits++;
+        storage->stats.committed++;
+        return 0;
     }
 
-    char date_str[DATE_LEN + 1];
-    print_date(date_str, date);
+    if (log->n_pending == log->pending_capacity) {
+        usize new_capacity = log->pending_capacity == 0 ? PENDING_INIT_CAPACITY : log->pending_capacity * 2;
+        PendingSample *pending = realloc(log->pending, sizeof(PendingSample) * new_capacity);
+        if (pending == NULL) {
+            fprintf(stderr, "Failed to allocate memory for %zu pending samples: %s (%d)\n", new_capacity,
+                    strerror(errno), errno);
+            return -1;
+        }
+        log->pending = pending;
+        log->pending_capacity = new_capacity;
+    }
 
-    char value_str[MSG_LEN]; // No +1 because we don't need a delimiter
-    snprintf(value_str, MSG_LEN, "%lf", value);
+    if (storage->stats.pending == 0)
+        storage->first_pending_secs = get_secs();
 
-    // printf("LOGGED: %s : %s\n", date_str, value_str);
-    fprintf(log->file, "%s : %s\n", date_str, value_str);
-    fflush(log->file);
+    log->pending[log->n_pending++] =
+        (PendingSample){.ts_ms = unix_ms, .temp = value, .max_period = max_period};
+    storage->stats.pending++;
+    if (storage->stats.pending > storage->stats.max_at_risk)
+        storage->stats.max_at_risk = storage->stats.pending;
 
     return 0;
 }
 
-f64 get_avg_log(Log *log, f64 period, DateTime *date)
+f64 get_avg_log(Log *log, f64 period, i64 unix_ms)
 {
+    // Buffered samples have to be in the file to be read.
+    if (log->storage->stats.pending > 0 && flush_log_storage(log->storage) == -1)
+        return INFINITY;
+
     i64 start_pos = ftello(log->file);
     if (start_pos == -1)
         return INFINITY;
@@ -129,7 +319,7 @@ f64 get_avg_log(Log *log, f64 period, DateTime *date)
             continue;
         }
 
-        if (to_secs(date) - t <= period) {
+        if ((f64)unix_ms / 1000 - t <= period) {
             f64 val;
             sscanf(line_buf, "%*s %*s : %lf", &val);
             sum += val;
@@ -147,8 +337,13 @@ f64 get_avg_log(Log *log, f64 period, DateTime *date)
     return sum / ctr;
 }
 
-int delete_old_entries(Log *log, DateTime *date, usize max_period)
+int delete_old_entries(Log *log, i64 unix_ms, usize max_period)
 {
+    if (check_writable(log) == -1)
+        return -1;
+    if (log->storage->stats.pending > 0 && flush_log_storage(log->storage) == -1)
+        return -1;
+
     assert(log->file != NULL);
     rewind(log->file);
 
@@ -168,7 +363,7 @@ int delete_old_entries(Log *log, DateTime *date, usize max_period)
 
         DateTime date_entry;
         int resd = scan_date(buf, &date_entry);
-        if (resd == 0 && to_secs(date) - to_secs(&date_entry) <= max_period) {
+        if (resd == 0 && (f64)unix_ms / 1000 - to_secs(&date_entry) <= max_period) {
             i64 read_pos = ftello(log->file);
 
             fseeko(log->file, write_pos, SEEK_SET);
@@ -191,6 +386,230 @@ int delete_old_entries(Log *log, DateTime *date, usize max_period)
     return 0;
 }
 
+TempArray *get_array_entries(Log *log, i64 start_ms, i64 end_ms)
+{
+    LogCursor *cursor = open_log_cursor(log, start_ms, end_ms);
+    if (cursor == NULL)
+        return NULL;
+
+    TempArray *array = xmalloc(sizeof(TempArray));
+    array->items = NULL;
+    array->size = 0;
+    usize capacity = 0;
+
+    TempEntry entry;
+    int res;
+    while ((res = next_log_entry(cursor, &entry)) == 1) {
+        if (array->size == capacity) {
+            usize new_capacity = capacity == 0 ? PENDING_INIT_CAPACITY : capacity * 2;
+            TempEntry *items = realloc(array->items, sizeof(TempEntry) * new_capacity);
+            if (items == NULL) {
+                fprintf(stderr, "Failed to allocate memory for TempArray of size %zu: %s (%d)\n",
+                        new_capacity, strerror(errno), errno);
+                res = -1;
+                break;
+            }
+            array->items = items;
+            capacity = new_capacity;
+        }
+        array->items[array->size++] = entry;
+    }
+    close_log_cursor(cursor);
+
+    if (res == -1) {
+        free(array->items);
+        free(array);
+        return NULL;
+    }
+    return array;
+}
+
+int get_log_version(Log *log, LogVersion *version)
+{
+    // Ring buffer overwrites lines in place, and file times are too coarse to notice every write
+    (void)log;
+    (void)version;
+    return -1;
+}
+
+int get_last_log_time(Log *log, i64 *unix_ms)
+{
+    // Newest line of the ring buffer can only be found by reading all of it
+    (void)log;
+    (void)unix_ms;
+    return -1;
+}
+
+LogCursor *open_log_cursor(Log *log, i64 start_ms, i64 end_ms)
+{
+    return open_log_cursor_after(log, start_ms, INT64_MIN, end_ms);
+}
+
+LogCursor *open_log_cursor_after(Log *log, i64 after_ms, i64 after_id, i64 end_ms)
+{
+    if (log->storage->stats.pending > 0 && flush_log_storage(log->storage) == -1)
+        return NULL;
+
+    i64 start_pos = ftello(log->file);
+    i64 size = fsize(log->file);
+    if (start_pos == -1 || size == -1)
+        return NULL;
+
+    LogCursor *cursor = xmalloc(sizeof(LogCursor));
+    cursor->log = log;
+    cursor->start_pos = start_pos;
+    cursor->size = size;
+    cursor->is_wrapped = false;
+    cursor->start_ms = after_ms;
+    cursor->end_ms = end_ms;
+    cursor->after_id = after_id;
+    cursor->last_ms = INT64_MIN;
+    cursor->last_id = 0;
+    return cursor;
+}
+
+LogCursor *open_log_cursor_by_id(Log *log, i64 after_id, i64 last_id)
+{
+    // Lines have no ids, get_log_version fails before ids could be asked for
+    (void)log;
+    (void)after_id;
+    (void)last_id;
+    fprintf(stderr, "Filesystem logs can't be read by id!\n");
+    return NULL;
+}
+
+int next_log_entry(LogCursor *cursor, TempEntry *entry)
+{
+    FILE *file = cursor->log->file;
+    char line_buf[LOG_LINE_LEN + 1];
+    while (true) {
+        i64 pos = ftello(file);
+        if (pos == -1)
+            return -1;
+
+        if (cursor->is_wrapped && pos >= cursor->start_pos)
+            return 0;
+
+        // Lines after the start position are older ones, which weren't overwritten by the ring buffer yet.
+        bool is_read = pos < cursor->size && fgets(line_buf, LOG_LINE_LEN + 1, file) != NULL;
+        if (!is_read && ferror(file))
+            return -1;
+        if (!is_read && cursor->is_wrapped)
+            return 0;
+        if (!is_read) {
+            rewind(file);
+            cursor->is_wrapped = true;
+            continue;
+        }
+
+        DateTime date;
+        if (scan_date(line_buf, &date) == -1 || sscanf(line_buf, "%*s %*s : %lf", &entry->temp) != 1) {
+            fprintf(stderr, "Incorrect entry found in the log file!: \"%s\"\n", line_buf);
+            continue;
+        }
+
+        i64 ts_ms = llround(to_secs(&date) * 1000);
+        if (ts_ms < cursor->start_ms || ts_ms > cursor->end_ms)
+            continue;
+
+        cursor->last_id = ts_ms == cursor->last_ms ? cursor->last_id + 1 : 1;
+        cursor->last_ms = ts_ms;
+        if (ts_ms == cursor->start_ms && cursor->last_id <= cursor->after_id)
+            continue;
+        entry->ts_ms = ts_ms;
+        return 1;
+    }
+}
+
+i64 get_log_cursor_id(const LogCursor *cursor)
+{
+    return cursor->last_id;
+}
+
+void close_log_cursor(LogCursor *cursor)
+{
+    fseeko(cursor->log->file, cursor->start_pos, SEEK_SET);
+    free(cursor);
+}
+
+static LogStorage *open_storage(const char *log_dir, bool read_only)
+{
+    LogStorage *storage = xmalloc(sizeof(LogStorage));
+    storage->log_dir = log_dir;
+    storage->read_only = read_only;
+    storage->durability = (LogDurability){.commit_samples = 1, .commit_period = 0, .sync = LOG_SYNC_FULL};
+    storage->stats = (LogStats){0};
+    storage->first_pending_secs = 0;
+    storage->logs = NULL;
+    return storage;
+}
+
+static int check_writable(const Log *log)
+{
+    if (!log->storage->read_only)
+        return 0;
+    fprintf(stderr, "Failed to write to log: storage is opened read-only!\n");
+    return -1;
+}
+
+/// Write line to log file without flushing it, reusing space of the old lines.
+/// Return 0 on success, -1 on error.
+static int write_line(Log *log, f64 value, i64 ts_ms, usize max_period)
+{
+    f64 secs = (f64)ts_ms / 1000;
+    int at_end = fatend(log->file);
+    if (at_end == -1) {
+        fprintf(stderr, "No longer able to access log file! %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    if (at_end && secs - log->first_entry_time > max_period) {
+        rewind(log->file);
+        log->first_entry_time = secs;
+    }
+
+    // Lines keep local time as text
+    DateTime date;
+    get_datetime_from_secs(&date, secs);
+    char date_str[DATE_LEN + 1];
+    print_date(date_str, &date);
+
+    char value_str[MSG_LEN]; // No +1 because we don't need a delimiter
+    snprintf(value_str, MSG_LEN, "%lf", value);
+
+    // printf("LOGGED: %s : %s\n", date_str, value_str);
+    fprintf(log->file, "%s : %s\n", date_str, value_str);
+
+    return 0;
+}
+
+static void save_ring_position(Log *log, RingPosition *ring)
+{
+    ring->pos = ftello(log->file);
+    ring->size = fsize(log->file);
+    ring->first_entry_time = log->first_entry_time;
+}
+
+/// Moves the ring back to where it was before writing lines that failed to flush.
+/// Seeking drops whatever is left of them in the stream buffer, and the part that reached the end
+/// of the file is cut off, so the retry writes all of them again the same way.
+/// Return 0 on success, -1 otherwise.
+static int restore_ring_position(Log *log, const RingPosition *ring)
+{
+    if (ring->pos == -1 || ring->size == -1 || fseeko(log->file, ring->pos, SEEK_SET) == -1) {
+        perror("Failed to rewind log after failed write");
+        return -1;
+    }
+    clearerr(log->file);
+    log->first_entry_time = ring->first_entry_time;
+
+    i64 size = fsize(log->file);
+    if (size > ring->size && ftrunc(log->file, ring->size) == -1) {
+        perror("Failed to cut log after failed write");
+        return -1;
+    }
+    return 0;
+}
+
 /// Inplace swap all the data before the current file pos and after the current file pos.
 /// Is used to sort file ring buffer.
 /// Return 0 on success, -1 otherwise.
@@ -4,11 +4,17 @@
 #include "cross_time.h"
 
 
+struct LogStorage;
+typedef struct LogStorage LogStorage;
+
 struct Log;
 typedef struct Log Log;
 
+struct LogCursor;
+typedef struct LogCursor LogCursor;
+
 typedef struct {
-    DateTime date;
+    i64 ts_ms; // Unix time in milliseconds
     f64 temp;
 } TempEntry;
 
@@ -17,28 +23,136 @@ typedef struct {
     usize size;
 } TempArray;
 
+/// Version of committed log contents. Logs are only appended to and trimmed from the oldest end,
+/// and row ids are never reused, so the id of the newest entry grows with every write and the id of
+/// the oldest one grows with every delete. Both are 0 for an empty log.
+typedef struct {
+    i64 min_id;
+    i64 max_id;
+} LogVersion;
+
+typedef enum {
+    LOG_SYNC_FULL,   // Every commit is synced to disk
+    LOG_SYNC_NORMAL, // Commits are synced on WAL checkpoints only and may be lost on power failure
+} LogSync;
+
+/// Group commit settings of the storage.
+/// Samples are buffered in memory and committed in one transaction once any of the limits is reached.
+/// Default is to commit each batch right away: commit_samples = 1, commit_period = 0, sync = LOG_SYNC_FULL.
+typedef struct {
+    usize commit_samples; // Commit once this many samples are buffered, 0 for no limit
+    f64 commit_period;    // Commit once the oldest buffered sample is this old in seconds, 0 for no limit
+    LogSync sync;         // Ignored by filesystem backend, which never syncs files
+} LogDurability;
+
+/// Counters of samples which are not durable yet.
+typedef struct {
+    usize pending;     // Samples buffered in memory, lost if the process dies
+    usize unsynced;    // Samples committed but not synced to disk yet, lost on power failure
+    usize max_at_risk; // Maximum of pending + unsynced seen so far
+    u64 commits;       // Commits done, of a single sample or of a group
+    u64 committed;     // Samples committed, including the ones committed on their own
+} LogStats;
+
+
+/// Open storage shared by all the logs: database file or directory for log files.
+/// The caller is responsible for freeing memory with close_log_storage, after all its logs are deinitialized.
+/// Exit with code 1 on failure.
+LogStorage *open_log_storage(const char path[]);
+
+/// Open storage for reading only, logs have to be created by a writer beforehand.
+/// Each reader thread should open its own storage, a storage is not safe to share between threads.
+/// Writing functions fail on logs of read-only storage.
+/// Exit with code 1 on failure.
+LogStorage *open_log_storage_readonly(const char path[]);
+
+/// Close log storage.
+/// Return 0 on success, -1 on error.
+int close_log_storage(LogStorage *storage);
 
-/// Initialize Log structure. 
+/// Set group commit settings, flushing samples buffered with the previous ones.
+/// Return 0 on success, -1 on error.
+int set_log_durability(LogStorage *storage, const LogDurability *durability);
+
+/// Get durability counters of the storage.
+void get_log_stats(LogStorage *storage, LogStats *stats);
+
+/// Begin batch of writes: everything written to storage logs until end_log_batch is committed at once.
+/// Return 0 on success, -1 on error.
+int begin_log_batch(LogStorage *storage);
+
+/// Commit batch of writes started with begin_log_batch, the batch is discarded on error.
+/// With group commit, buffered samples are committed only when one of durability limits is reached.
+/// Return 0 on success, -1 on error.
+int end_log_batch(LogStorage *storage);
+
+/// Commit all the samples buffered for group commit right away.
+/// Return 0 on success, -1 on error, samples stay buffered on error.
+int flush_log_storage(LogStorage *storage);
+
+/// Initialize Log structure, which is a view of single log (table or file) in the storage.
 /// The caller is responsible for freeing memory with deinit_log.
 /// Exit with code 1 on failure.
-Log *init_log(const char db_path[], const char table_name[]);
+Log *init_log(LogStorage *storage, const char log_name[]);
 
 /// Deinitialize Log structure.
 int deinit_log(Log *log);
 
-/// Write new date-value to log, deleting old ones.
-/// It is not guaranteed that all the old values will be removed on first call.
-int write_log(Log *log, f64 value, DateTime *date, usize max_period);
+/// Write new value to log, stamped with Unix time in milliseconds.
+/// Old entries are not deleted here, call delete_old_entries on its own cadence for that.
+/// Filesystem backend may still reuse space of entries older than max_period.
+int write_log(Log *log, f64 value, i64 unix_ms, usize max_period);
 
-// Return average within given period from given date in log.
-f64 get_avg_log(Log *log, f64 period, DateTime *date);
+// Return average within given period before Unix time in milliseconds in log, including samples buffered
+// for group commit.
+f64 get_avg_log(Log *log, f64 period, i64 unix_ms);
 
-/// Delete all invalid or old log entries.
+/// Delete all invalid log entries and the ones older than max_period seconds before Unix time
+/// in milliseconds.
 /// Return 0 on success, -1 on error.
-int delete_old_entries(Log *log, DateTime *date, usize max_period);
+int delete_old_entries(Log *log, i64 unix_ms, usize max_period);
 
-/// Get an array of all entries within the provided date range.
+/// Get an array of all entries within range of Unix milliseconds [start_ms, end_ms], including samples
+/// buffered for group commit. Range not limited at the start or the end has INT64_MIN or INT64_MAX there.
 /// Caller is responsible for memory freeing.
 /// If invalid entry is encountered it is replaced with (TempEntry){0}.
 /// Return pointer to allocated TempArray or NULL on error.
-TempArray *get_array_entries(Log *log, const DateTime *date_start, const DateTime *date_end);
+TempArray *get_array_entries(Log *log, i64 start_ms, i64 end_ms);
+
+/// Get version of committed log contents, equal versions of a log mean equal contents.
+/// Return 0 on success, -1 on error or if the backend can't tell versions, as filesystem backend can't.
+int get_log_version(Log *log, LogVersion *version);
+
+/// Get unix time in milliseconds of the newest committed entry, samples waiting for commit are not seen.
+/// Return 1 on success, 0 if the log is empty, -1 on error or if the backend can't find it cheaply,
+/// as filesystem backend can't.
+int get_last_log_time(Log *log, i64 *unix_ms);
+
+/// Open cursor reading the same entries as get_array_entries one at a time, in order of time and row id,
+/// without buffering all of them.
+/// Only one cursor of a log may be open at a time, and the log must not be written to until it's closed.
+/// The caller is responsible for closing it with close_log_cursor.
+/// Return pointer to cursor or NULL on error.
+LogCursor *open_log_cursor(Log *log, i64 start_ms, i64 end_ms);
+
+/// Open cursor reading the same entries as open_log_cursor within [after_ms, end_ms], except the ones
+/// at after_ms with row id up to after_id, to resume reading right after the entry of that time and id.
+/// Return pointer to cursor or NULL on error.
+LogCursor *open_log_cursor_after(Log *log, i64 after_ms, i64 after_id, i64 end_ms);
+
+/// Open cursor over the committed entries with row ids in (after_id, last_id], ids as in LogVersion,
+/// in order they were written. Backends which can't tell versions fail.
+/// Return pointer to cursor or NULL on error.
+LogCursor *open_log_cursor_by_id(Log *log, i64 after_id, i64 last_id);
+
+/// Read the next entry of the cursor.
+/// Return 1 if entry is read, 0 if there are no more entries, -1 on error.
+int next_log_entry(LogCursor *cursor, TempEntry *entry);
+
+/// Get row id of the entry read last by the cursor. Cursors read entries of the same time in order of
+/// their ids, which filesystem backend numbers from 1 among lines of the same time in file order.
+/// Samples buffered for group commit have no ids yet and get 0.
+i64 get_log_cursor_id(const LogCursor *cursor);
+
+/// Close cursor and release the log for other operations.
+void close_log_cursor(LogCursor *cursor);
@@ -0,0 +1,95 @@
+/// Counters are plain integers updated with GCC atomic builtins, which compile to single lock-prefixed
+/// instructions, so threads recording metrics never wait for each other.
+
+#include "metrics.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "my_types.h"
+
+static usize get_bucket(f64 secs);
+
+void add_counter(u64 *counter, u64 n)
+{
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+void add_gauge(i64 *gauge, i64 delta)
+{
+    __atomic_fetch_add(gauge, delta, __ATOMIC_RELAXED);
+}
+
+u64 load_counter(const u64 *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+i64 load_gauge(const i64 *gauge)
+{
+    return __atomic_load_n(gauge, __ATOMIC_RELAXED);
+}
+
+void observe_histogram(Histogram *histogram, f64 secs)
+{
+    add_counter(&histogram->buckets[get_bucket(secs)], 1);
+    add_counter(&histogram->sum_ns, secs > 0 ? (u64)llround(secs * 1e9) : 0);
+    add_counter(&histogram->count, 1);
+}
+
+void print_metrics(MetricsText *text, const char *format, ...)
+{
+    if (text->is_truncated)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text->data + text->len, text->capacity - text->len, format, args);
+    va_end(args);
+
+    if (n < 0 || (usize)n >= text->capacity - text->len)
+        text->is_truncated = true;
+    else
+        text->len += n;
+}
+
+void print_histogram(MetricsText *text, const char *name, const char *labels, const Histogram *histogram)
+{
+    const char *sep = labels[0] != '\0' ? "," : "";
+
+    // %g prints powers of 2 exactly, as they have short decimal expansions
+    u64 cumulative = 0;
+    for (usize i = 0; i < METRICS_N_BUCKETS; i++) {
+        cumulative += load_counter(&histogram->buckets[i]);
+        if (i + 1 < METRICS_N_BUCKETS)
+            print_metrics(text, "%s_bucket{%s%sle=\"%.17g\"} %llu\n", name, labels, sep,
+                          ldexp(1, METRICS_FIRST_BUCKET_LOG2 + (int)i), (unsigned long long)cumulative);
+        else
+            print_metrics(text, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+                          (unsigned long long)cumulative);
+    }
+
+    const char *braces_open = labels[0] != '\0' ? "{" : "";
+    const char *braces_close = labels[0] != '\0' ? "}" : "";
+    print_metrics(text, "%s_sum%s%s%s %.9f\n", name, braces_open, labels, braces_close,
+                  (f64)load_counter(&histogram->sum_ns) / 1e9);
+    print_metrics(text, "%s_count%s%s%s %llu\n", name, braces_open, labels, braces_close,
+                  (unsigned long long)load_counter(&histogram->count));
+}
+
+/// Find the first bucket with upper bound 2^k s not less than secs.
+static usize get_bucket(f64 secs)
+{
+    if (!(secs > 0))
+        return 0;
+
+    // secs = m * 2^exp with m in [0.5, 1), so it's at most 2^exp, or exactly 2^(exp - 1) if m is 0.5
+    int exp;
+    f64 m = frexp(secs, &exp);
+    int k = m == 0.5 ? exp - 1 : exp;
+    i64 bucket = (i64)k - METRICS_FIRST_BUCKET_LOG2;
+    if (bucket < 0)
+        return 0;
+    return bucket >= METRICS_N_BUCKETS ? METRICS_N_BUCKETS - 1 : (usize)bucket;
+}
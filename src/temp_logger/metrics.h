@@ -0,0 +1,44 @@
+#pragma once
+
+#include "my_types.h"
+
+// Histogram buckets have upper bounds of powers of 2 seconds, from 2^-20 s (about 1 us) to 2^5 s,
+// the last bucket counts everything longer.
+#define METRICS_FIRST_BUCKET_LOG2 -20
+#define METRICS_N_BUCKETS 27
+
+/// Latency histogram updated by many threads at once with relaxed atomics, so it's never locked.
+/// Readers may see counts of an observation before its sum, which Prometheus tolerates.
+typedef struct {
+    u64 buckets[METRICS_N_BUCKETS]; // Not cumulative, they are summed up when printed
+    u64 sum_ns;
+    u64 count;
+} Histogram;
+
+/// Text of Prometheus exposition printed into a fixed-size buffer.
+typedef struct {
+    char *data;
+    usize len;
+    usize capacity;
+    bool is_truncated; // Text didn't fit into the buffer
+} MetricsText;
+
+/// Add n to counter shared between threads.
+void add_counter(u64 *counter, u64 n);
+
+/// Add delta to gauge shared between threads.
+void add_gauge(i64 *gauge, i64 delta);
+
+/// Read counter or gauge updated by other threads.
+u64 load_counter(const u64 *counter);
+i64 load_gauge(const i64 *gauge);
+
+/// Count duration of secs in histogram.
+void observe_histogram(Histogram *histogram, f64 secs);
+
+/// Append printf formatted text, it is marked truncated if it doesn't fit.
+void print_metrics(MetricsText *text, const char *format, ...);
+
+/// Append histogram samples: cumulative buckets, sum in seconds and count.
+/// labels is a list like stage="parse" added to the labels of every sample, or empty string.
+void print_histogram(MetricsText *text, const char *name, const char *labels, const Histogram *histogram);
@@ -0,0 +1,90 @@
+/// Buckets are kept in an open-addressing table probed a few slots from the hash of the client.
+/// If all of them are taken by other clients, the least recently seen one is evicted and starts over
+/// with a full bucket once it comes back, which only matters when more clients are active than tracked.
+
+#include "rate_limit.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "my_types.h"
+#include "utils.h"
+
+#define RATE_LIMIT_MAX_PROBES 8
+
+typedef struct {
+    u32 client;
+    bool is_used;
+    f64 tokens;
+    f64 last_time; // Time tokens were last refilled
+} ClientBucket;
+
+struct RateLimiter {
+    f64 rate;
+    f64 burst;
+    ClientBucket *buckets;
+    usize mask; // Number of buckets minus 1
+};
+
+static ClientBucket *find_bucket(RateLimiter *limiter, u32 client, f64 now);
+
+RateLimiter *create_rate_limiter(f64 rate, f64 burst, usize max_clients)
+{
+    assert(max_clients > 0 && (max_clients & (max_clients - 1)) == 0);
+
+    RateLimiter *limiter = xmalloc(sizeof(RateLimiter));
+    limiter->rate = rate;
+    limiter->burst = burst < 1 ? 1 : burst;
+    limiter->buckets = xmalloc(sizeof(ClientBucket) * max_clients);
+    for (usize i = 0; i < max_clients; i++)
+        limiter->buckets[i].is_used = false;
+    limiter->mask = max_clients - 1;
+    return limiter;
+}
+
+void destroy_rate_limiter(RateLimiter *limiter)
+{
+    free(limiter->buckets);
+    free(limiter);
+}
+
+bool take_rate_token(RateLimiter *limiter, u32 client, f64 now)
+{
+    if (limiter->rate <= 0)
+        return true;
+
+    ClientBucket *bucket = find_bucket(limiter, client, now);
+    f64 elapsed = now > bucket->last_time ? now - bucket->last_time : 0;
+    bucket->tokens += elapsed * limiter->rate;
+    if (bucket->tokens > limiter->burst)
+        bucket->tokens = limiter->burst;
+    bucket->last_time = now;
+
+    if (bucket->tokens < 1)
+        return false;
+    bucket->tokens -= 1;
+    return true;
+}
+
+/// Find bucket of the client, or take a free or the least recently used one for it.
+static ClientBucket *find_bucket(RateLimiter *limiter, u32 client, f64 now)
+{
+    // High bits of Fibonacci hashing are well mixed even for neighbouring addresses
+    usize start = (usize)(((u64)client * 0x9E3779B97F4A7C15ULL) >> 32);
+
+    ClientBucket *victim = NULL;
+    for (usize i = 0; i < RATE_LIMIT_MAX_PROBES; i++) {
+        ClientBucket *bucket = &limiter->buckets[(start + i) & limiter->mask];
+        if (bucket->is_used && bucket->client == client)
+            return bucket;
+        if (!bucket->is_used) {
+            if (victim == NULL || victim->is_used)
+                victim = bucket;
+        } else if (victim == NULL || (victim->is_used && bucket->last_time < victim->last_time)) {
+            victim = bucket;
+        }
+    }
+
+    *victim = (ClientBucket){.client = client, .is_used = true, .tokens = limiter->burst, .last_time = now};
+    return victim;
+}
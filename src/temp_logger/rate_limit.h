@@ -0,0 +1,20 @@
+#pragma once
+
+#include "my_types.h"
+
+/// Token bucket of requests per client address: every client may make burst requests at once,
+/// and then rate requests per second on average.
+/// Not thread-safe, it's used by the event loop only.
+struct RateLimiter;
+typedef struct RateLimiter RateLimiter;
+
+/// Create limiter tracking at most max_clients clients, which is a power of 2.
+/// Rate of 0 disables limiting.
+/// Exit with code 1 on failure.
+RateLimiter *create_rate_limiter(f64 rate, f64 burst, usize max_clients);
+
+void destroy_rate_limiter(RateLimiter *limiter);
+
+/// Take token of the client for a request at time now in seconds.
+/// Return true if client may make the request, false if it's over the limit.
+bool take_rate_token(RateLimiter *limiter, u32 client, f64 now);
@@ -0,0 +1,149 @@
+/// Entries are few and large, so they are kept in a plain array: lookup and eviction scan it
+/// linearly under the lock, which takes nothing next to copying a response.
+
+#include "response_cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cross_thread.h"
+#include "my_types.h"
+#include "utils.h"
+
+typedef struct {
+    u8 key[RESPONSE_CACHE_KEY_MAX_LEN];
+    usize key_len;
+    u8 version[RESPONSE_CACHE_VERSION_MAX_LEN];
+    usize version_len;
+    char *response;
+    usize response_len;
+    u64 last_used; // Value of ResponseCache.clock when the entry was last stored or found
+} CacheEntry;
+
+struct ResponseCache {
+    Mutex mutex;
+    CacheEntry *entries;
+    usize n_entries;
+    usize max_entries;
+    usize n_bytes;
+    usize max_bytes;
+    u64 clock;
+};
+
+static i64 find_entry(ResponseCache *cache, const void *key, usize key_len);
+static void remove_entry(ResponseCache *cache, usize i);
+
+ResponseCache *create_response_cache(usize max_entries, usize max_bytes)
+{
+    ResponseCache *cache = xmalloc(sizeof(ResponseCache));
+    init_mutex(&cache->mutex);
+    cache->entries = xmalloc(sizeof(CacheEntry) * max_entries);
+    cache->n_entries = 0;
+    cache->max_entries = max_entries;
+    cache->n_bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->clock = 0;
+    return cache;
+}
+
+void destroy_response_cache(ResponseCache *cache)
+{
+    for (usize i = 0; i < cache->n_entries; i++)
+        free(cache->entries[i].response);
+    free(cache->entries);
+    destroy_mutex(&cache->mutex);
+    free(cache);
+}
+
+char *get_cached_response(ResponseCache *cache, const void *key, usize key_len, const void *version,
+                          usize version_len, usize *response_len)
+{
+    char *response = NULL;
+    lock_mutex(&cache->mutex);
+
+    i64 i = find_entry(cache, key, key_len);
+    if (i == -1)
+        goto end;
+
+    CacheEntry *entry = &cache->entries[i];
+    if (entry->version_len != version_len || memcmp(entry->version, version, version_len) != 0) {
+        remove_entry(cache, i);
+        goto end;
+    }
+
+    response = malloc(entry->response_len);
+    if (response == NULL) {
+        fprintf(stderr, "Failed to malloc for cached response of size %zu: %s (%d)\n", entry->response_len,
+                strerror(errno), errno);
+        goto end;
+    }
+    memcpy(response, entry->response, entry->response_len);
+    *response_len = entry->response_len;
+    entry->last_used = ++cache->clock;
+
+end:
+    unlock_mutex(&cache->mutex);
+    return response;
+}
+
+void put_cached_response(ResponseCache *cache, const void *key, usize key_len, const void *version,
+                         usize version_len, const char *response, usize response_len)
+{
+    assert(key_len <= RESPONSE_CACHE_KEY_MAX_LEN && version_len <= RESPONSE_CACHE_VERSION_MAX_LEN);
+    if (response_len > cache->max_bytes / 4 || cache->max_entries == 0)
+        return;
+
+    // Copy is made outside of the lock, it's dropped if it fails
+    char *copy = malloc(response_len);
+    if (copy == NULL)
+        return;
+    memcpy(copy, response, response_len);
+
+    lock_mutex(&cache->mutex);
+
+    i64 i = find_entry(cache, key, key_len);
+    if (i != -1)
+        remove_entry(cache, i);
+
+    while (cache->n_entries == cache->max_entries || cache->n_bytes + response_len > cache->max_bytes) {
+        usize lru = 0;
+        for (usize j = 1; j < cache->n_entries; j++) {
+            if (cache->entries[j].last_used < cache->entries[lru].last_used)
+                lru = j;
+        }
+        remove_entry(cache, lru);
+    }
+
+    CacheEntry *entry = &cache->entries[cache->n_entries++];
+    memcpy(entry->key, key, key_len);
+    entry->key_len = key_len;
+    memcpy(entry->version, version, version_len);
+    entry->version_len = version_len;
+    entry->response = copy;
+    entry->response_len = response_len;
+    entry->last_used = ++cache->clock;
+    cache->n_bytes += response_len;
+
+    unlock_mutex(&cache->mutex);
+}
+
+/// Return index of the entry with given key or -1 if there is none.
+static i64 find_entry(ResponseCache *cache, const void *key, usize key_len)
+{
+    for (usize i = 0; i < cache->n_entries; i++) {
+        if (cache->entries[i].key_len == key_len && memcmp(cache->entries[i].key, key, key_len) == 0)
+            return (i64)i;
+    }
+    return -1;
+}
+
+/// Free the entry and move the last one into its place.
+static void remove_entry(ResponseCache *cache, usize i)
+{
+    cache->n_bytes -= cache->entries[i].response_len;
+    free(cache->entries[i].response);
+    cache->entries[i] = cache->entries[--cache->n_entries];
+}
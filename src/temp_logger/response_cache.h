@@ -0,0 +1,31 @@
+#pragma once
+
+#include "my_types.h"
+
+// Keys and versions are compared bytewise, so structs used for them must be zeroed including padding.
+#define RESPONSE_CACHE_KEY_MAX_LEN 96
+#define RESPONSE_CACHE_VERSION_MAX_LEN 64
+
+/// LRU cache of whole responses shared by worker threads.
+/// Every entry is valid only for the version of data it was created from, given by caller.
+struct ResponseCache;
+typedef struct ResponseCache ResponseCache;
+
+/// Create cache of at most max_entries responses of max_bytes in total.
+/// Exit with code 1 on failure.
+ResponseCache *create_response_cache(usize max_entries, usize max_bytes);
+
+/// Free cache with all its entries.
+void destroy_response_cache(ResponseCache *cache);
+
+/// Find response cached under key. Entry created from other version of data is stale, so it's dropped.
+/// Caller is responsible for freeing the returned copy of response.
+/// Return copy of the response with its length in response_len, or NULL if there is none or on error.
+char *get_cached_response(ResponseCache *cache, const void *key, usize key_len, const void *version,
+                          usize version_len, usize *response_len);
+
+/// Store copy of response under key and version, replacing the previous one,
+/// and evict least recently used entries until the cache fits into its limits.
+/// Responses larger than a quarter of the cache are not stored.
+void put_cached_response(ResponseCache *cache, const void *key, usize key_len, const void *version,
+                         usize version_len, const char *response, usize response_len);
@@ -0,0 +1,57 @@
+/// Binary serialization of log entries, see temp_binary.h for the format.
+/// Values are written byte by byte in little-endian order, so the format doesn't depend on the host,
+/// compilers turn it into plain stores on little-endian hosts.
+
+#include "temp_binary.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "logger_interface.h"
+#include "my_types.h"
+
+static void write_u32_le(char *dest, u32 value);
+static void write_u64_le(char *dest, u64 value);
+
+usize get_temp_binary_len(usize n_entries)
+{
+    return TEMP_BINARY_HEADER_LEN + n_entries * (sizeof(i64) + sizeof(f64));
+}
+
+char *write_temp_binary(char *dest, const TempArray *array, usize n_entries)
+{
+    assert(n_entries <= TEMP_BINARY_MAX_ENTRIES);
+
+    memcpy(dest, TEMP_BINARY_MAGIC, 4);
+    write_u32_le(dest + 4, (u32)n_entries);
+
+    char *ts_column = dest + TEMP_BINARY_HEADER_LEN;
+    char *temp_column = ts_column + n_entries * sizeof(i64);
+    usize n = 0;
+    for (usize i = 0; i < array->size; i++) {
+        const TempEntry *entry = &array->items[i];
+        if (memcmp(entry, &(TempEntry){0}, sizeof(TempEntry)) == 0)
+            continue;
+
+        u64 temp_bits;
+        memcpy(&temp_bits, &entry->temp, sizeof(temp_bits));
+        write_u64_le(ts_column + n * sizeof(i64), (u64)entry->ts_ms);
+        write_u64_le(temp_column + n * sizeof(f64), temp_bits);
+        n++;
+    }
+    assert(n == n_entries);
+
+    return temp_column + n_entries * sizeof(f64);
+}
+
+static void write_u32_le(char *dest, u32 value)
+{
+    for (usize i = 0; i < sizeof(value); i++)
+        dest[i] = (char)(value >> (8 * i));
+}
+
+static void write_u64_le(char *dest, u64 value)
+{
+    for (usize i = 0; i < sizeof(value); i++)
+        dest[i] = (char)(value >> (8 * i));
+}
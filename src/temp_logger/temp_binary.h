@@ -0,0 +1,19 @@
+#pragma once
+
+#include "logger_interface.h"
+#include "my_types.h"
+
+// Columnar little-endian format, which clients map to typed arrays without parsing:
+//   "TKB1" magic, u32 number of entries n, i64[n] unix time in milliseconds, f64[n] temperatures.
+// Both columns are 8-byte aligned from the start of the body.
+#define TEMP_BINARY_MAGIC "TKB1"
+#define TEMP_BINARY_HEADER_LEN 8
+#define TEMP_BINARY_MAX_ENTRIES UINT32_MAX
+
+/// Get exact size of binary body of n entries.
+usize get_temp_binary_len(usize n_entries);
+
+/// Write all non-null entries of the array as binary body, n_entries is their count.
+/// dest needs get_temp_binary_len(n_entries) bytes.
+/// Return pointer to the end of written body.
+char *write_temp_binary(char *dest, const TempArray *array, usize n_entries);
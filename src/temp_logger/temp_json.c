@@ -0,0 +1,174 @@
+/// JSON serialization of log entries, the hot path of range responses.
+/// Numbers are formatted by hand: printf family parses its format and goes through locale
+/// for every number, which dominated the time of serializing large ranges.
+
+#include "temp_json.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger_interface.h"
+#include "my_types.h"
+
+#define F64_MAX_DECIMALS 21
+#define F64_MAX_DIGITS_LIMIT 100000000000000000ull // 10^17, 17 significant digits always round-trip
+
+typedef unsigned __int128 u128;
+
+static const char DIGIT_PAIRS[] = "0001020304050607080910111213141516171819"
+                                  "2021222324252627282930313233343536373839"
+                                  "4041424344454647484950515253545556575859"
+                                  "6061626364656667686970717273747576777879"
+                                  "8081828384858687888990919293949596979899";
+
+static char *print_u64(char *dest, u64 value, usize min_digits);
+static usize count_digits(u64 value);
+
+char *print_json_i64(char *dest, i64 value)
+{
+    u64 abs_value = (u64)value;
+    if (value < 0) {
+        *dest++ = '-';
+        abs_value = 0 - abs_value; // Well-defined for INT64_MIN too, unlike negation of i64
+    }
+    return print_u64(dest, abs_value, 1);
+}
+
+char *print_json_f64(char *dest, f64 value)
+{
+    if (!isfinite(value)) {
+        memcpy(dest, "null", 4);
+        return dest + 4;
+    }
+    if (signbit(value))
+        *dest++ = '-';
+    if (value == 0) {
+        *dest++ = '0';
+        return dest;
+    }
+
+    u64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    i32 exponent = (i32)((bits >> 52) & 0x7ff);
+    u64 fraction = bits & ((1ull << 52) - 1);
+
+    // Normal value below 2^53 is m / 2^shift with 53-bit m. Find the fewest decimals d for which some
+    // integer n makes n / 10^d parse back to value, i.e. value is the nearest f64 to it.
+    // All the products are exact in 128 bits: m * 10^d < 2^53 * 10^21 < 2^123.
+    i32 shift = 1075 - exponent;
+    if (exponent != 0 && shift >= 0 && shift < 128) {
+        u128 m = fraction | (1ull << 52);
+        // At power of 2 the gap to the previous f64 is half of the gap to the next one
+        bool is_lower_gap_half = fraction == 0 && exponent > 1;
+
+        u128 pow10 = 1;
+        for (usize decimals = 0; decimals <= F64_MAX_DECIMALS; decimals++, pow10 *= 10) {
+            u128 scaled = m * pow10;
+            u128 n = shift == 0 ? scaled : (scaled + ((u128)1 << (shift - 1))) >> shift;
+            if (n >= F64_MAX_DIGITS_LIMIT)
+                break;
+
+            // Nearest f64 to n / 10^d is value if |n / 10^d - m / 2^shift| is less than half the gap
+            // to the neighbouring f64, which is 1 / 2^shift. Ties are rejected, as those depend on
+            // rounding to even. Scaled by 2 * 10^d * 2^shift (4 * ... below power of 2) to stay integer.
+            u128 n_scaled = n << shift;
+            bool is_below = n_scaled < scaled;
+            u128 diff = is_below ? scaled - n_scaled : n_scaled - scaled;
+            if (diff * (is_below && is_lower_gap_half ? 4 : 2) >= pow10)
+                continue;
+
+            // Fewer than 17 significant digits, so n and the 10^d dividing it fit into 64 bits
+            u64 digits = (u64)n;
+            u64 divisor = decimals <= 17 ? (u64)pow10 : 0;
+            dest = print_u64(dest, divisor != 0 ? digits / divisor : 0, 1);
+            if (decimals > 0) {
+                *dest++ = '.';
+                // Can't end with 0, as then fewer decimals would do
+                dest = print_u64(dest, divisor != 0 ? digits % divisor : digits, decimals);
+            }
+            return dest;
+        }
+    }
+
+    // Too large, too small or too precise for plain notation: %g drops trailing zeros,
+    // so the first precision which round-trips gives the shortest digits.
+    f64 abs_value = fabs(value);
+    char buf[JSON_F64_MAX_LEN + 1];
+    int n = 0;
+    for (int precision = 1; precision <= 17; precision++) {
+        n = snprintf(buf, sizeof(buf), "%.*g", precision, abs_value);
+        if (strtod(buf, NULL) == abs_value)
+            break;
+    }
+    memcpy(dest, buf, n);
+    return dest + n;
+}
+
+char *print_temp_json_entry(char *dest, const TempEntry *entry)
+{
+    memcpy(dest, "{\"ts\":", 6);
+    dest = print_json_i64(dest + 6, entry->ts_ms);
+    memcpy(dest, ",\"temp\":", 8);
+    dest = print_json_f64(dest + 8, entry->temp);
+    *dest++ = '}';
+    return dest;
+}
+
+usize get_temp_json_max_len(usize n_entries)
+{
+    usize commas = n_entries > 0 ? n_entries - 1 : 0;
+    return strlen(TEMP_JSON_START) + n_entries * TEMP_JSON_ENTRY_MAX_LEN + commas + strlen(TEMP_JSON_END);
+}
+
+char *print_temp_json(char *dest, const TempArray *array)
+{
+    memcpy(dest, TEMP_JSON_START, strlen(TEMP_JSON_START));
+    char *pos = dest + strlen(TEMP_JSON_START);
+    char *entries_start = pos;
+    for (usize i = 0; i < array->size; i++) {
+        if (memcmp(&array->items[i], &(TempEntry){0}, sizeof(TempEntry)) == 0)
+            continue;
+
+        if (pos != entries_start) // Insert comma between each entry
+            *pos++ = ',';
+        pos = print_temp_json_entry(pos, &array->items[i]);
+    }
+    memcpy(pos, TEMP_JSON_END, strlen(TEMP_JSON_END));
+    return pos + strlen(TEMP_JSON_END);
+}
+
+/// Print value with at least min_digits digits, padded with leading zeros.
+static char *print_u64(char *dest, u64 value, usize min_digits)
+{
+    usize n_digits = count_digits(value);
+    if (n_digits < min_digits)
+        n_digits = min_digits;
+
+    // Digits are written from the end, two at a time
+    char *pos = dest + n_digits;
+    while (value >= 100) {
+        usize pair = (value % 100) * 2;
+        value /= 100;
+        *--pos = DIGIT_PAIRS[pair + 1];
+        *--pos = DIGIT_PAIRS[pair];
+    }
+    if (value >= 10) {
+        *--pos = DIGIT_PAIRS[value * 2 + 1];
+        *--pos = DIGIT_PAIRS[value * 2];
+    } else {
+        *--pos = (char)('0' + value);
+    }
+    while (pos > dest)
+        *--pos = '0';
+    return dest + n_digits;
+}
+
+static usize count_digits(u64 value)
+{
+    usize n = 1;
+    for (; value >= 10; value /= 10)
+        n++;
+    return n;
+}
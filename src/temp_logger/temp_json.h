@@ -0,0 +1,37 @@
+#pragma once
+
+#include "logger_interface.h"
+#include "my_types.h"
+
+// Longest outputs of the number printers, without null terminator.
+#define JSON_I64_MAX_LEN 20 // -9223372036854775808
+#define JSON_F64_MAX_LEN 24 // -1.2345678901234567e-308
+
+// {"data":[{"ts":1700000000000,"temp":21.5},...]}
+#define TEMP_JSON_START "{\"data\":["
+#define TEMP_JSON_END "]}"
+// Page of the series ends with the cursor to continue after instead: ...],"next":"1.1700000000000.42"}
+// or null.
+#define TEMP_JSON_PAGE_END "],\"next\":"
+#define TEMP_JSON_ENTRY_MAX_LEN (sizeof("{\"ts\":,\"temp\":}") - 1 + JSON_I64_MAX_LEN + JSON_F64_MAX_LEN)
+
+/// Print integer in decimal, dest needs JSON_I64_MAX_LEN bytes.
+/// Return pointer to the end of printed number, nothing is null-terminated.
+char *print_json_i64(char *dest, i64 value);
+
+/// Print the shortest decimal which parses back to the same value, dest needs JSON_F64_MAX_LEN bytes.
+/// Values below 2^53 with up to 21 decimal places are printed in plain notation, others in %g notation.
+/// NaN and infinities, which JSON can't represent, are printed as null.
+/// Return pointer to the end of printed number, nothing is null-terminated.
+char *print_json_f64(char *dest, f64 value);
+
+/// Print entry as {"ts":1700000000000,"temp":21.5}, dest needs TEMP_JSON_ENTRY_MAX_LEN bytes.
+/// Return pointer to the end of printed entry, nothing is null-terminated.
+char *print_temp_json_entry(char *dest, const TempEntry *entry);
+
+/// Get exact size of the longest JSON of n entries print_temp_json can print, without null terminator.
+usize get_temp_json_max_len(usize n_entries);
+
+/// Print all non-null entries of the array as JSON document, dest needs get_temp_json_max_len bytes.
+/// Return pointer to the end of printed document, nothing is null-terminated.
+char *print_temp_json(char *dest, const TempArray *array);
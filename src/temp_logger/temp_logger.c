@@ -1,6 +1,7 @@
 #include "temp_logger.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <math.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -63,90 +64,234 @@ int read_value(FILE *dev, f64 *value)
     return 0;
 }
 
-int write_log_with_avg(Log *log_out, Log *log_in, f64 avg_period, f64 keep_period, DateTime *date)
+/// Running average of samples written to one log, emitted as a single sample of the next log every period.
+/// Rollups are chained: every emitted sample is pushed to the rollup of the next log.
+typedef struct {
+    Log *log_out;
+    f64 period;
+    usize keep_period;
+
+    f64 sum;
+    usize count;
+    f64 last_emit;
+} Rollup;
+
+void push_rollup(Rollup *rollup, f64 value)
 {
-    f64 avg = get_avg_log(log_in, avg_period, date);
-    if (avg == INFINITY) {
-        fprintf(stderr, "Failed to get average from log!\n");
-        return -1;
+    rollup->sum += value;
+    rollup->count++;
+}
+
+/// If the period has passed since the last emit, write average of collected samples to the output log.
+/// Return true and set emitted value if it was written, false otherwise.
+bool emit_rollup(Rollup *rollup, f64 secs, i64 now_ms, f64 *value)
+{
+    if (secs - rollup->last_emit < rollup->period)
+        return false;
+    rollup->last_emit = secs;
+
+    if (rollup->count == 0)
+        return false;
+
+    f64 avg = rollup->sum / rollup->count;
+    rollup->sum = 0;
+    rollup->count = 0;
+
+    if (write_log(rollup->log_out, avg, now_ms, rollup->keep_period) == -1) {
+        fprintf(stderr, "Failed to write average to log! Skipping...\n");
+        return false;
     }
-    int res = write_log(log_out, avg, date, keep_period);
-    if (res == -1) {
-        fprintf(stderr, "Failed to write to log!\n");
-        return -1;
+
+    *value = avg;
+    return true;
+}
+
+/// Restore rollup state after restart.
+/// If output log was written within the last period, continue that period,
+/// collecting input log entries written after it. Otherwise start a new period.
+void recover_rollup(Rollup *rollup, Log *log_in, f64 secs)
+{
+    rollup->sum = 0;
+    rollup->count = 0;
+    rollup->last_emit = secs;
+
+    i64 end_ms = llround(secs * 1000);
+    TempArray *out = get_array_entries(rollup->log_out, llround((secs - rollup->period) * 1000), end_ms);
+    if (out == NULL)
+        return;
+    f64 last_out = -INFINITY;
+    for (usize i = 0; i < out->size; i++) {
+        f64 t = (f64)out->items[i].ts_ms / 1000;
+        if (t > last_out)
+            last_out = t;
     }
-    return 0;
+    free(out->items);
+    free(out);
+
+    if (last_out == -INFINITY)
+        return;
+    rollup->last_emit = last_out;
+
+    TempArray *in = get_array_entries(log_in, llround(rollup->last_emit * 1000), end_ms);
+    if (in == NULL)
+        return;
+    for (usize i = 0; i < in->size; i++) {
+        if ((f64)in->items[i].ts_ms / 1000 > rollup->last_emit)
+            push_rollup(rollup, in->items[i].temp);
+    }
+    free(in->items);
+    free(in);
 }
 
-int delete_old_logs_entries(Log **logs, DateTime *date)
+int delete_old_logs_entries(Log **logs, i64 now_ms)
 {
-    int res1 = delete_old_entries(logs[0], date, MAX_KEEP_LOG1);
-    int res2 = delete_old_entries(logs[1], date, MAX_KEEP_LOG2);
-    int res3 = delete_old_entries(logs[2], date, MAX_KEEP_LOG3);
+    int res1 = delete_old_entries(logs[0], now_ms, MAX_KEEP_LOG1);
+    int res2 = delete_old_entries(logs[1], now_ms, MAX_KEEP_LOG2);
+    int res3 = delete_old_entries(logs[2], now_ms, MAX_KEEP_LOG3);
     return (res1 == 0) && (res2 == 0) && (res3 == 0);
 }
 
+/// Delete old entries from each log whose retention period has passed since its last cleanup.
+void delete_due_logs_entries(Log **logs, f64 *last_cleanup, f64 secs)
+{
+    static const usize max_keep[] = {MAX_KEEP_LOG1, MAX_KEEP_LOG2, MAX_KEEP_LOG3};
+    static const f64 retention_period[] = {
+        RETENTION_PERIOD_LOG1,
+        RETENTION_PERIOD_LOG2,
+        RETENTION_PERIOD_LOG3,
+    };
+
+    for (int i = 0; i < 3; i++) {
+        if (retention_period[i] == 0 || secs - last_cleanup[i] < retention_period[i])
+            continue;
+
+        if (delete_old_entries(logs[i], llround(secs * 1000), max_keep[i]) == -1)
+            fprintf(stderr, "Failed to delete old entries of log %d! Skipping...\n", i + 1);
+        else
+            last_cleanup[i] = secs;
+    }
+}
+
+/// Find durability settings by profile name.
+/// Return 0 on success, -1 if there is no such profile.
+int get_durability_profile(const char *name, LogDurability *durability)
+{
+    static const struct {
+        const char *name;
+        LogDurability durability;
+    } profiles[] = {
+        // Commit and sync every sample
+        {"full", {.commit_samples = 1, .commit_period = 0, .sync = LOG_SYNC_FULL}},
+        // Commit every sample, sync on WAL checkpoints
+        {"normal", {.commit_samples = 1, .commit_period = 0, .sync = LOG_SYNC_NORMAL}},
+        // Commit and sync buffered samples every GROUP_COMMIT_SAMPLES or GROUP_COMMIT_PERIOD
+        {"group",
+         {.commit_samples = GROUP_COMMIT_SAMPLES, .commit_period = GROUP_COMMIT_PERIOD, .sync = LOG_SYNC_FULL}},
+    };
+
+    for (usize i = 0; i < sizeof(profiles) / sizeof(*profiles); i++) {
+        if (streql(name, profiles[i].name)) {
+            *durability = profiles[i].durability;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void print_log_stats(LogStorage *storage)
+{
+    LogStats stats;
+    get_log_stats(storage, &stats);
+    fprintf(stderr,
+            "Durability: %zu samples pending, %zu unsynced, at most %zu at risk, %" PRIu64
+            " samples in %" PRIu64 " commits\n",
+            stats.pending, stats.unsynced, stats.max_at_risk, stats.committed, stats.commits);
+}
+
 // TODO: prefix each stderr message with either FAIL or WARN, depending on severity
 int main(int argc, char *argv[])
 {
     int res;
-    if (argc != 3) {
-        fprintf(stderr, "Usage: temp_logger DEVICE LOG_PATH\n");
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: temp_logger DEVICE LOG_PATH [full|normal|group]\n");
         exit(2);
     }
     signal(SIGINT, sigint_handler);
 
+    LogDurability durability;
+    const char *profile = argc == 4 ? argv[3] : DEFAULT_DURABILITY_PROFILE;
+    if (get_durability_profile(profile, &durability) == -1) {
+        fprintf(stderr, "Unknown durability profile: %s\n", profile);
+        exit(2);
+    }
+
     const char *dev_name = argv[1];
     FILE *dev_file = xfopen(dev_name, "r");
 
+    LogStorage *storage = open_log_storage(argv[2]);
+    if (set_log_durability(storage, &durability) == -1) {
+        fprintf(stderr, "Failed to set durability profile %s\n", profile);
+        exit(1);
+    }
+
     Log *logs[3];
     for (int i = 0; i < 3; i++)
-        logs[i] = init_log(argv[2], LOG_ARGS[i]);
+        logs[i] = init_log(storage, LOG_ARGS[i]);
 
-    DateTime date;
-    get_datetime_now(&date);
-    delete_old_logs_entries(logs, &date);
+    delete_old_logs_entries(logs, llround(get_secs() * 1000));
     
     fprintf(stderr, "Successfully initialized logs.\n");
 
     skip_old_values(dev_file);
     skip_till_value(dev_file);
 
-    f64 log2_last_write = get_secs();
-    f64 log3_last_write = log2_last_write;
+    f64 start_secs = get_secs();
+    f64 last_cleanup[3] = {start_secs, start_secs, start_secs};
+
+    // Averages for log 2 and log 3 are accumulated as samples arrive, logs are read only to recover them.
+    Rollup rollups[2] = {
+        {.log_out = logs[1], .period = PERIOD_LOG2, .keep_period = MAX_KEEP_LOG2},
+        {.log_out = logs[2], .period = PERIOD_LOG3, .keep_period = MAX_KEEP_LOG3},
+    };
+    recover_rollup(&rollups[0], logs[0], start_secs);
+    recover_rollup(&rollups[1], logs[1], start_secs);
 
     while (is_working) {
         f64 value;
         read_value(dev_file, &value);
 
+        // Samples are stamped with Unix time, local calendar time is ambiguous when clocks go back
         f64 secs = get_secs();
-        DateTime date;
-        get_datetime_from_secs(&date, secs);
+        i64 now_ms = llround(secs * 1000);
+
+        // All the logs are written in one transaction per sample, or per group commit if it's enabled.
+        if (begin_log_batch(storage) == -1) {
+            fprintf(stderr, "Failed to begin writing logs! Skipping...\n");
+            continue;
+        }
 
-        res = write_log(logs[0], value, &date, MAX_KEEP_LOG1);
+        res = write_log(logs[0], value, now_ms, MAX_KEEP_LOG1);
         if (res == -1)
             fprintf(stderr, "Failed to write log 1! Skipping...");
 
-        if (secs - log2_last_write >= PERIOD_LOG2) {
-            int res = write_log_with_avg(logs[1], logs[0], PERIOD_LOG2, MAX_KEEP_LOG2, &date);
-            if (res == -1)
-                fprintf(stderr, "Failed to write log 2! Skipping...");
-            else 
-                log2_last_write = secs;
+        for (int i = 0; i < 2; i++) {
+            push_rollup(&rollups[i], value);
+            if (!emit_rollup(&rollups[i], secs, now_ms, &value))
+                break;
         }
 
-        if (secs - log3_last_write >= PERIOD_LOG3) {
-            int res = write_log_with_avg(logs[2], logs[1], PERIOD_LOG3, MAX_KEEP_LOG3, &date);
-            if (res == -1)
-                fprintf(stderr, "Failed to write log 3! Skipping...");
-            else
-                log3_last_write = secs;
-        }
+        delete_due_logs_entries(logs, last_cleanup, secs);
+
+        if (end_log_batch(storage) == -1)
+            fprintf(stderr, "Failed to commit logs! Sample is lost...\n");
     }
 
     for (int i = 0; i < 3; i++)
         if (deinit_log(logs[i]))
             fprintf(stderr, "Failed to deinit log %d\n", i);
+    print_log_stats(storage);
+    if (close_log_storage(storage))
+        fprintf(stderr, "Failed to close log storage\n");
 
     if (fclose(dev_file) == -1)
         perror("Failed to close device");
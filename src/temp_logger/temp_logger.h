@@ -6,6 +6,13 @@
 #define MAX_KEEP_LOG3 150
 #define PERIOD_LOG2 10
 #define PERIOD_LOG3 30
+// Expected seconds between raw samples of log 1, used to plan range queries
+#define SAMPLE_PERIOD_LOG1 1
+
+// Durability profile used when none is given on the command line, see get_durability_profile
+#define DEFAULT_DURABILITY_PROFILE "full"
+#define GROUP_COMMIT_SAMPLES 100
+#define GROUP_COMMIT_PERIOD 1.0
 
 #define DELIM '\n'
 #define MSG_LEN 8
@@ -14,6 +21,11 @@
 #define TABLE_NAME_LOG1 "log1"
 #define TABLE_NAME_LOG2 "log2"
 #define TABLE_NAME_LOG3 "log3"
+
+// Seconds between retention runs for each log, 0 disables periodic retention.
+#define RETENTION_PERIOD_LOG1 5
+#define RETENTION_PERIOD_LOG2 PERIOD_LOG2
+#define RETENTION_PERIOD_LOG3 PERIOD_LOG3
 #define LOG_ARGS                                                                                             \
     ((const char *const[]){                                                                                   \
         TABLE_NAME_LOG1,                                                                                     \
@@ -24,6 +36,11 @@
 #define FILE_NAME_LOG1 "log1.txt"
 #define FILE_NAME_LOG2 "log2.txt"
 #define FILE_NAME_LOG3 "log3.txt"
+
+// File logs overwrite expired entries themselves, so they are only cleaned up on start.
+#define RETENTION_PERIOD_LOG1 0
+#define RETENTION_PERIOD_LOG2 0
+#define RETENTION_PERIOD_LOG3 0
 #define LOG_ARGS                                                                                             \
     ((const char *const[]){                                                                                   \
         FILE_NAME_LOG1,                                                                                      \
@@ -7,55 +7,408 @@
 #include <unistd.h>
 
 #include "cross_socket.h"
+#include "cross_thread.h"
 #include "cross_time.h"
 #include "my_types.h"
 #include "utils.h"
 
+#include "access_log.h"
+#include "downsample.h"
+#include "http_parser.h"
 #include "logger_interface.h"
+#include "metrics.h"
+#include "rate_limit.h"
+#include "response_cache.h"
+#include "temp_binary.h"
+#include "temp_json.h"
 #include "temp_logger.h"
+#include "tier_plan.h"
 
 #define LISTEN_PORT 8080
-#define MAX_PENDING 10
-#define ACCEPT_TIMEOUT_MS 500
+#define MAX_PENDING 128
+#define POLL_TIMEOUT_MS 500
+#define MAX_POLL_EVENTS 256
+#define MAX_CONNECTIONS 4096 // Upper bound of --max-connections
 #define HTTP_GET_MAX_LEN 1024
 
-#define RESPONSE_HEADER_FSTRING                                                                              \
-    "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nContent-Type: application/json; charset=utf-8\r\nAccess-Control-Allow-Origin: *\r\n\r\n"
-#define RESPONSE_HEADER_MAX_LEN 256
-
 #define _TO_TEXT(S) #S
 #define TO_TEXT(S) _TO_TEXT(S)
 
-#define ERROR_RESPONSE_BUF_LEN 1024
-#define TEMP_SERIALIZE_LEN (MSG_LEN - 1)
+// Defaults of the limits set with command line options, see ServerLimits.
+#define DEFAULT_MAX_CONNECTIONS 1024
+#define DEFAULT_MAX_QUEUED 256
+#define DEFAULT_IDLE_TIMEOUT_SECS 5
+#define DEFAULT_HEADER_TIMEOUT_SECS 10
+#define DEFAULT_CLIENT_RATE 20.0
+#define DEFAULT_CLIENT_BURST 40.0
+#define RATE_LIMIT_MAX_CLIENTS 4096
+
+// Persistent connections are closed after being idle for timeout or serving max requests.
+#define KEEP_ALIVE_MAX_REQUESTS 100
+#define IDLE_CHECK_PERIOD_SECS 1.0
+#define CONNECTION_KEEP_ALIVE_FSTRING "keep-alive\r\nKeep-Alive: timeout=%u, max=%d"
+#define CONNECTION_KEEP_ALIVE_MAX_LEN 64
+#define CONNECTION_CLOSE "close"
+
+#define RESPONSE_HEADER_FSTRING                                                                              \
+    "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nContent-Type: %s\r\n%sVary: Accept\r\n"                       \
+    "Access-Control-Allow-Origin: *\r\nConnection: %s\r\n\r\n"
+#define RESPONSE_HEADER_MAX_LEN 384
+#define CONTENT_TYPE_JSON "application/json; charset=utf-8"
+#define CONTENT_TYPE_BINARY "application/octet-stream"
+
+// Header of streamed response, with chunked transfer coding for HTTP/1.1 clients.
+#define STREAM_HEADER_FSTRING                                                                                \
+    "HTTP/1.1 200 OK\r\n%sContent-Type: " CONTENT_TYPE_JSON "\r\n%sVary: Accept\r\n"                         \
+    "Access-Control-Allow-Origin: *\r\nConnection: %s\r\n\r\n"
+#define TRANSFER_ENCODING_CHUNKED "Transfer-Encoding: chunked\r\n"
+#define STREAM_CHUNK_SIZE 32768
+#define CHUNK_HEADER_MAX_LEN 18 // Size in hex and CRLF
+#define LAST_CHUNK "0\r\n\r\n"
+
+// Entity tag is a hash of the query and versions of the logs it reads, so it changes once any of them is
+// written to or trimmed, and clients polling unchanged data get empty 304 responses.
+#define ETAG_FSTRING "\"%016llx\""
+#define ETAG_LEN (sizeof("\"0123456789abcdef\"") - 1)
+#define ETAG_HEADER_FSTRING "ETag: %s\r\n"
+#define ETAG_HEADER_MAX_LEN (sizeof("ETag: \r\n") + ETAG_LEN)
+#define NOT_MODIFIED_FSTRING                                                                                 \
+    "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nVary: Accept\r\n"                                              \
+    "Access-Control-Allow-Origin: *\r\nConnection: %s\r\n\r\n"
+
+#define DOWNSAMPLE_MODE_MAX_LEN 16
+#define TIER_NAME_MAX_LEN 8
+
+// Range query with "limit" is read in pages, each one continuing after the last entry of the previous one.
+// Streamed pages end with the cursor in the body, binary ones tell it in header.
+// Cursor is the log number, time and row id of the entry, as entries of the same time are not unique.
+#define PAGE_MAX_ENTRIES 10000
+#define PAGE_CURSOR_FSTRING "%d.%lld.%lld"
+#define PAGE_CURSOR_MAX_LEN (sizeof("3..") - 1 + 2 * JSON_I64_MAX_LEN)
+#define NEXT_AFTER_HEADER_FSTRING "Next-After: %s\r\nAccess-Control-Expose-Headers: Next-After, ETag\r\n"
+#define NEXT_AFTER_HEADER_MAX_LEN (sizeof(NEXT_AFTER_HEADER_FSTRING) + PAGE_CURSOR_MAX_LEN)
+
+// Unpaged queries which need all the entries at once read at most this many of them. Binary response
+// is cut short and tells cursor of the rest in header, downsampling more entries is refused with 413.
+#define RANGE_MAX_ENTRIES (1 << 20)
+
+#define MAX_WORKERS 64
+
+#define DEFAULT_ACCESS_LOG_LEVEL "info"
+#define ACCESS_LOG_BUFFER_SIZE (1024 * 1024)
+#define ACCESS_LOG_PAYLOAD_MAX_LEN 1024 // Longest escaped target or payload in access log
+
+// Whole responses of buffered queries are cached, until logs they were created from change.
+#define RESPONSE_CACHE_MAX_ENTRIES 64
+#define RESPONSE_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+#define METRICS_PATH "/metrics"
+#define METRICS_MAX_LEN 65536
+#define CONTENT_TYPE_METRICS "text/plain; version=0.0.4; charset=utf-8"
+
+// Live stream of new entries as Server-Sent Events. Entries are written by another process,
+// so the hub polls versions of the logs for new rows.
+#define STREAM_PATH "/stream"
+#define SSE_POLL_PERIOD_MS 250
+#define SSE_HEARTBEAT_SECS 15.0 // Comment line keeping proxies from closing quiet streams
+#define SSE_RETRY_MS 1000       // Reconnection delay of EventSource
+#define SSE_MAX_SUBSCRIBERS 256
+#define SSE_EVENT_MAX_ENTRIES 256   // Rows of a log per event, more new rows are split into several events
+#define SSE_MAX_RESUME_ENTRIES 3600 // Rows of a log replayed to resuming client, older ones need range query
+#define SSE_HEADER                                                                                           \
+    "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"                      \
+    "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n"                                            \
+    "retry: " TO_TEXT(SSE_RETRY_MS) "\n\n"
+#define SSE_HEARTBEAT ": heartbeat\n\n"
+#define SSE_EVENT_HEADER_MAX_LEN (sizeof("event: tier1\nid: ,,\ndata: [") - 1 + 3 * JSON_I64_MAX_LEN)
+#define SSE_EVENT_MAX_LEN                                                                                    \
+    (SSE_EVENT_HEADER_MAX_LEN + SSE_EVENT_MAX_ENTRIES * (TEMP_JSON_ENTRY_MAX_LEN + 1) + sizeof("]\n\n"))
+
+typedef enum {
+    CONN_READING,   // Receiving request on the event loop
+    CONN_QUERYING,  // Request is processed by a worker
+    CONN_WRITING,   // Sending response on the event loop
+    CONN_STREAMING, // Subscribed to the live stream, owned by the hub
+    CONN_CLOSING,   // Last response is sent, waiting for client to close connection
+} ConnState;
+
+typedef struct StreamState StreamState;
+
+/// Client connection, a state machine driven by the event loop.
+/// The connection is owned by the worker while it is querying, by the hub while it is streaming,
+/// and by the event loop otherwise.
+/// Worker sends streamed responses to the socket itself as long as the socket takes them. Once it's full,
+/// the worker hands the rest of the chunk to the event loop as buffered body, and the connection goes
+/// back to a worker to continue the stream once the event loop sends it.
+/// Pipelined requests are read into the buffer along with the current one and are handled in order,
+/// the socket is not read until the current response is sent.
+typedef struct Connection {
+    Socket socket;
+    ConnState state;
+    u32 poll_events; // PollFlags the socket is watched for, 0 if it's not in the poller
+    usize slot;      // Index in Server.conns
+    f64 last_active; // Time of the last read or written response, to close idle connections
+    usize n_requests;
+    bool keep_alive; // Keep connection open after the current response
+    u32 client_addr; // IPv4 address in network byte order, for rate limiting
+
+    char request[HTTP_GET_MAX_LEN + 1];
+    usize request_len; // Bytes received, may contain pipelined requests after the current one
+    usize request_end; // End of the current request
+    f64 request_start; // Time the first byte of the current request was received
+    HttpRequest http;  // Current request, parsed incrementally as it's received
+
+    // Buffered response, header and body are sent together from separate buffers
+    char header[RESPONSE_HEADER_MAX_LEN];
+    usize header_len; // 0 if the worker streams the response, body is then the part the socket didn't take
+    char *body;       // NULL if the response has no body
+    usize body_len;
+    usize response_sent; // Bytes of header and body sent
+    StreamState *stream; // Streamed response to be continued by a worker, NULL if there is none
+    bool is_broken;      // Streamed response failed midway, so the connection can only be closed
+
+    // Live stream subscription, continued by the hub after the event loop sends the rest of an event
+    bool is_subscribed;   // Event stream header is taken by the socket or the event loop
+    bool is_unsubscribed; // Client left the live stream, which is how the stream ends rather than abort
+    i64 event_ids[3];     // Ids of the last rows of the logs in the events the subscriber got
+
+    // Timing and size of the current request for access log
+    f64 dispatch_time;    // Request is received whole
+    f64 query_start;      // Worker or hub took the request
+    f64 query_end;        // Worker or hub is done with the request
+    usize bytes_streamed; // Bytes sent by workers or hub, event loop counts rest of stream in response_sent
+
+    struct Connection *next; // Next connection in ConnQueue
+} Connection;
+
+/// FIFO of connections passed between the event loop and worker threads.
+typedef struct {
+    Connection *head;
+    Connection *tail;
+    bool is_closed; // No more connections will be pushed, workers exit once queue is drained
+    usize len;
+    Mutex mutex;
+    CondVar not_empty;
+} ConnQueue;
+
+typedef struct StreamHub StreamHub;
+
+/// Single-threaded event loop doing all the socket I/O, queries are run by workers.
+typedef struct {
+    Poller *poller;
+    Socket listen_socket;
+    Socket wake_pair[2]; // Workers write to wake_pair[1] once a response is ready
+
+    ConnQueue requests;  // Read requests waiting for a worker
+    ConnQueue responses; // Responses ready to be sent
+    ResponseCache *cache;
+    StreamHub *hub;
+    RateLimiter *limiter;
+
+    Connection *conns[MAX_CONNECTIONS];
+    usize n_conns;
+} Server;
+
+/// Worker thread with its own read-only connection to the storage.
+typedef struct {
+    Thread thread;
+    const char *db_path;
+    Server *server;
+} Worker;
+
+/// Thread pushing new entries of the logs to subscribed clients as Server-Sent Events, one event per log
+/// and batch of rows. Event id holds ids of the last rows of all the logs the client got,
+/// so it resumes with Last-Event-ID from where it stopped.
+/// Subscriber whose socket doesn't take a whole event is passed to the event loop with the rest of it,
+/// and joins again once it's sent, getting the events it missed meanwhile the same way as a resuming client.
+/// Failed subscribers are passed to the event loop to be closed.
+struct StreamHub {
+    Thread thread;
+    const char *db_path;
+    Server *server;
+    ConnQueue joining;   // Stream requests waiting for the hub
+    Socket wake_pair[2]; // Event loop writes to wake_pair[1] once a request is pushed to joining
+
+    Connection *subscribers[SSE_MAX_SUBSCRIBERS];
+    usize n_subscribers;
+    i64 last_ids[3]; // Ids of the last rows of the logs sent to subscribers
+    f64 last_heartbeat;
+    char event[SSE_EVENT_MAX_LEN];
+};
+
+typedef enum {
+    RESPONSE_JSON,   // Default, streamed unless downsampled
+    RESPONSE_BINARY, // Columnar temp_binary format for "Accept: application/octet-stream"
+} ResponseFormat;
+
+/// Range query parameters of a request.
+typedef struct {
+    i64 start_ms;       // INT64_MIN if range is not limited at the start
+    i64 end_ms;         // INT64_MAX if range is not limited at the end
+    usize max_points;   // 0 if downsampling is not requested
+    DownsampleMode mode;
+    ResponseFormat format;
+    int tier;           // Log number from "tier" parameter, 0 to plan logs automatically
+    TierPlan plan;      // Logs to read, planned for the whole range, so that all the pages read the same ones
+    usize limit;        // Entries per page, 0 if paging is not requested
+    TierPosition after; // Last entry of the previous page, tier is -1 for the first page
+} RangeQuery;
+
+/// Key of cached response body, compared bytewise, so it's zeroed including padding before it's filled.
+typedef struct {
+    i64 start_ms;
+    i64 end_ms;
+    i64 after_ms;
+    i64 after_id;
+    u64 max_points;
+    u64 limit;
+    i32 after_tier;
+    u32 mode;   // DownsampleMode, DOWNSAMPLE_LTTB if not downsampled
+    u32 format; // ResponseFormat
+    u32 finest_tier;
+    u32 preferred_tier;
+    u32 coarsest_tier;
+} CacheKey;
+
+/// Versions of the logs taken before the query reads them, and entity tag of its response derived from them.
+/// A write in between can only make the response newer than the versions, so it's refetched sooner.
+typedef struct {
+    bool is_known; // Backend can tell log versions, otherwise responses are neither cached nor tagged
+    LogVersion logs[3];
+    char etag[ETAG_LEN + 1];
+    char etag_header[ETAG_HEADER_MAX_LEN]; // Empty if versions are not known
+} QueryVersion;
+
+/// Fixed-size buffer of streamed response body.
+/// Every chunk is sent with a single call along with its framing from separate buffers,
+/// and so is the response header before the first chunk. Socket is never waited for, the part of chunk
+/// it doesn't take right away is copied aside for the event loop to send.
+typedef struct {
+    Socket socket;
+    bool is_chunked;
+    bool is_header_sent;
+    char header[RESPONSE_HEADER_MAX_LEN];
+    usize header_len;
+    usize len;      // Bytes of body buffered
+    usize n_sent;   // Bytes sent including headers, by workers and by the event loop
+    char *rest;     // Part of the last chunk the socket didn't take, NULL if it took all of it
+    usize rest_len;
+    char buf[STREAM_CHUNK_SIZE];
+} ChunkWriter;
+
+/// Range query response streamed over several turns of workers, each one continuing after the entry
+/// the previous one has written last, so a slow client ties up only its connection, never a worker.
+struct StreamState {
+    RangeQuery query;
+    TierPosition last; // Entry written last, tier is -1 before the first one
+    usize n_entries;
+    bool has_next;     // Page is full and the series continues after it
+    bool is_drained;   // All the entries and the end of body are written, only the last chunk is left
+    f64 stream_secs;   // Time spent streaming by workers
+    ChunkWriter writer;
+};
+
+/// Limits keeping misbehaving clients from starving the others, set with command line options.
+/// Requests over the limits are answered right on the event loop, before any database work starts.
+typedef struct {
+    usize max_connections;   // More clients are answered with 503 and closed right after accepting
+    usize max_queued;        // Requests waiting for workers, more are answered with 503
+    u32 idle_timeout_secs;   // Waiting for the next request, for client to close or to read the response
+    u32 header_timeout_secs; // Receiving the whole request since its first byte
+    f64 client_rate;         // Average requests per second of a client address, 0 disables rate limiting
+    f64 client_burst;        // Requests a client address may make at once, more are answered with 429
+} ServerLimits;
+
+/// Stages of request handling timed by latency histograms.
+typedef enum {
+    STAGE_PARSE,     // Parsing request head on the event loop
+    STAGE_QUEUE,     // Waiting for a worker
+    STAGE_QUERY,     // Reading entries of buffered response from the logs
+    STAGE_SERIALIZE, // Downsampling and printing buffered response
+    STAGE_STREAM,    // Reading, printing and sending streamed response by workers, in all their turns
+    STAGE_SEND,      // Sending buffered response on the event loop
+    STAGE_TOTAL,     // From receiving the whole request to finishing the response
+    N_STAGES,
+} Stage;
+
+static const char *const STAGE_NAMES[N_STAGES] = {"parse", "queue", "query", "serialize", "stream", "send",
+                                                  "total"};
+
+// Requests with other statuses are counted together
+static const int STATUS_CODES[] = {200, 304, 400, 405, 413, 429, 500, 503};
+#define N_STATUS_CODES (sizeof(STATUS_CODES) / sizeof(*STATUS_CODES))
+
+/// Metrics shared by all the threads, updated with atomic operations.
+typedef struct {
+    Histogram stages[N_STAGES];
+    u64 requests[N_STATUS_CODES + 1]; // By status, the last one counts other statuses
+    u64 aborted_requests;
+    u64 response_bytes;
+    u64 cache_hits;
+    u64 cache_misses;
+    i64 connections;
+    i64 subscribers;
+} ServerMetrics;
+
+void write_response(Server *server, Connection *conn);
 
 static bool is_working = true;
+static AccessLog *access_log;
+static ServerMetrics metrics;
+static ServerLimits limits = {
+    .max_connections = DEFAULT_MAX_CONNECTIONS,
+    .max_queued = DEFAULT_MAX_QUEUED,
+    .idle_timeout_secs = DEFAULT_IDLE_TIMEOUT_SECS,
+    .header_timeout_secs = DEFAULT_HEADER_TIMEOUT_SECS,
+    .client_rate = DEFAULT_CLIENT_RATE,
+    .client_burst = DEFAULT_CLIENT_BURST,
+};
+static char connection_keep_alive[CONNECTION_KEEP_ALIVE_MAX_LEN]; // Connection header value with idle timeout
 void sigint_handler(int sig)
 {
     (void)sig;
     is_working = false;
 }
 
-int respond_client(Socket client, char *message)
+const char *get_connection_header(bool keep_alive)
 {
-    int res = send(client, message, strlen(message), 0);
-    if (res == -1)
-        perror("Failed to respond to client");
-    return res;
+    return keep_alive ? connection_keep_alive : CONNECTION_CLOSE;
 }
 
-int respond_error(Socket client, char *code, const char *message)
+/// Print response without body into buf of RESPONSE_HEADER_MAX_LEN bytes.
+/// Return length of the response.
+usize print_error_response(char *buf, const char *code, const char *message, bool keep_alive)
 {
-    char response[ERROR_RESPONSE_BUF_LEN];
-    int n = snprintf(response, ERROR_RESPONSE_BUF_LEN, "HTTP/1.1 %s %s\r\n\r\n", code, message);
-    assert(n < ERROR_RESPONSE_BUF_LEN);
+    int n = snprintf(buf, RESPONSE_HEADER_MAX_LEN,
+                     "HTTP/1.1 %s %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n", code, message,
+                     get_connection_header(keep_alive));
+    assert(n < RESPONSE_HEADER_MAX_LEN);
+    return n;
+}
 
-    return respond_client(client, response);
+void set_error_response(Connection *conn, const char *code, const char *message)
+{
+    conn->header_len = print_error_response(conn->header, code, message, conn->keep_alive);
+    conn->body = NULL;
+    conn->body_len = 0;
+}
+
+void set_server_error_response(Connection *conn)
+{
+    set_error_response(conn, "500", "Internal Server Error");
 }
 
-int respond_server_error(Socket client)
+/// Set successful response with body, which is freed along with the connection or its next response.
+/// extra_headers are lines added to the header, each ending with CRLF.
+void set_body_response(Connection *conn, char *body, usize body_len, const char *content_type,
+                       const char *extra_headers)
 {
-    return respond_error(client, "500", "Internal Server Error");
+    int n = snprintf(conn->header, RESPONSE_HEADER_MAX_LEN, RESPONSE_HEADER_FSTRING, body_len, content_type,
+                     extra_headers, get_connection_header(conn->keep_alive));
+    assert(n < RESPONSE_HEADER_MAX_LEN);
+    conn->header_len = n;
+    conn->body = body;
+    conn->body_len = body_len;
 }
 
 bool is_entry_null(TempEntry *entry)
@@ -73,266 +426,1820 @@ usize count_not_null(TempArray *array)
     return ctr;
 }
 
-// {"data":[{"date":"YYYY-MM-DD hh:mm:ss.sss","temp":12.0000},]}
-char *print_json(TempArray *array, char *dest)
+/// Create response body with all the non-null entries of the array in given format.
+/// Binary body may contain null bytes and neither is null-terminated, so its length is returned in body_len.
+/// Return NULL on error.
+char *create_body(TempArray *array, ResponseFormat format, usize *body_len)
 {
-    char *pos = dest;
+    assert(array != NULL);
 
-    pos += sprintf(pos, "{\"data\":[");
-    for (usize i = 0; i < array->size; i++) {
-        if (is_entry_null(&array->items[i]))
-            continue;
+    usize n_entries = count_not_null(array);
+    if (format == RESPONSE_BINARY && n_entries > TEMP_BINARY_MAX_ENTRIES) {
+        write_access_log(access_log, ACCESS_LOG_ERROR,
+                         "msg=\"Too many entries for binary response\" entries=%zu", n_entries);
+        return NULL;
+    }
+
+    // Upper bound for JSON, the exact size is known only after printing.
+    // Header is printed into its own buffer once the size is known, so the body is never moved.
+    usize body_max_size =
+        format == RESPONSE_BINARY ? get_temp_binary_len(n_entries) : get_temp_json_max_len(n_entries);
+
+    char *body = malloc(sizeof(char) * body_max_size);
+    if (body == NULL) {
+        write_access_log(access_log, ACCESS_LOG_ERROR, "msg=\"Failed to malloc for response\" size=%zu",
+                         body_max_size);
+        return NULL;
+    }
+
+    char *body_end =
+        format == RESPONSE_BINARY ? write_temp_binary(body, array, n_entries) : print_temp_json(body, array);
+    *body_len = body_end - body;
+    return body;
+}
 
-        if (pos != dest + 9) { // Insert comma between each entry
-            sprintf(pos, ",");
+const char *get_content_type(ResponseFormat format)
+{
+    return format == RESPONSE_BINARY ? CONTENT_TYPE_BINARY : CONTENT_TYPE_JSON;
+}
+
+/// Parse downsampling parameters: "max_points" or its alias "width", the number of points
+/// the client is going to draw, and optional "mode" (lttb by default).
+/// max_points is set to 0 if downsampling is not requested.
+/// Return 0 on success, -1 if any of the values is invalid.
+int parse_downsample_params(const HttpRequest *request, usize *max_points, DownsampleMode *mode)
+{
+    *max_points = 0;
+    *mode = DOWNSAMPLE_LTTB;
+
+    i64 points;
+    int res = parse_http_param_i64(request, "max_points", &points);
+    if (res == 0)
+        res = parse_http_param_i64(request, "width", &points);
+    if (res == -1 || (res == 1 && points < 0))
+        return -1;
+    if (res == 1)
+        *max_points = (usize)points;
+
+    const Slice *mode_value = find_http_param(request, "mode");
+    if (mode_value != NULL) {
+        char mode_name[DOWNSAMPLE_MODE_MAX_LEN + 1];
+        if (decode_http_component(*mode_value, mode_name, sizeof(mode_name)) == -1)
+            return -1;
+        if (parse_downsample_mode(mode_name, mode) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/// Parse "tier" parameter: number of the only log to read, 1 to 3, or "auto" to plan logs by the range.
+/// tier is set to 0 if logs are planned automatically.
+/// Return 0 on success, -1 if the value is invalid.
+int parse_tier_param(const HttpRequest *request, int *tier)
+{
+    *tier = 0;
+    const Slice *value = find_http_param(request, "tier");
+    if (value == NULL)
+        return 0;
+
+    char name[TIER_NAME_MAX_LEN + 1];
+    if (decode_http_component(*value, name, sizeof(name)) == -1)
+        return -1;
+    if (strcmp(name, "auto") == 0)
+        return 0;
+    if (strlen(name) != 1 || name[0] < '1' || name[0] > '3')
+        return -1;
+    *tier = name[0] - '0';
+    return 0;
+}
+
+/// Print cursor of the entry at position, dest needs PAGE_CURSOR_MAX_LEN + 1 bytes.
+/// Return length of the cursor.
+int print_page_cursor(char *dest, const TierPosition *position)
+{
+    return sprintf(dest, PAGE_CURSOR_FSTRING, position->tier + 1, (long long)position->ts_ms,
+                   (long long)position->id);
+}
+
+/// Parse paging parameters: "limit", the number of entries per page, which is clamped to PAGE_MAX_ENTRIES,
+/// and "after", the cursor of the last entry of the previous page as printed by print_page_cursor.
+/// limit is set to 0 if paging is not requested, after tier to -1 if it's the first page.
+/// Return 0 on success, -1 if any of the values is invalid.
+int parse_page_params(const HttpRequest *request, usize *limit, TierPosition *after)
+{
+    *limit = 0;
+    *after = (TierPosition){.tier = -1, .ts_ms = INT64_MIN, .id = 0};
+
+    i64 value;
+    int res = parse_http_param_i64(request, "limit", &value);
+    if (res == -1 || (res == 1 && value <= 0))
+        return -1;
+    if (res == 1)
+        *limit = value < PAGE_MAX_ENTRIES ? (usize)value : PAGE_MAX_ENTRIES;
+
+    const Slice *cursor_value = find_http_param(request, "after");
+    if (cursor_value == NULL)
+        return 0;
+
+    char cursor[PAGE_CURSOR_MAX_LEN + 1];
+    int tier;
+    long long ts_ms, id;
+    int n = -1;
+    if (decode_http_component(*cursor_value, cursor, sizeof(cursor)) == -1 ||
+        sscanf(cursor, PAGE_CURSOR_FSTRING "%n", &tier, &ts_ms, &id, &n) != 3 || cursor[n] != '\0' ||
+        tier < 1 || tier > 3)
+        return -1;
+    *after = (TierPosition){.tier = tier - 1, .ts_ms = ts_ms, .id = id};
+    return 0;
+}
+
+/// Check if client accepts binary response: "application/octet-stream" is listed in Accept header.
+/// Client is expected to list it only if it prefers it, so quality values are not compared.
+bool is_binary_accepted(const HttpRequest *request)
+{
+    const Slice *accept = find_http_header(request, "Accept");
+    if (accept == NULL)
+        return false;
+
+    // Value is a list of media ranges with optional parameters, e.g. "application/octet-stream;q=0.9, */*"
+    for (usize pos = 0; pos < accept->len;) {
+        usize item_end = pos;
+        while (item_end < accept->len && accept->ptr[item_end] != ',')
+            item_end++;
+        usize type_end = pos;
+        while (type_end < item_end && accept->ptr[type_end] != ';')
+            type_end++;
+        while (pos < type_end && accept->ptr[pos] == ' ')
             pos++;
+        while (type_end > pos && accept->ptr[type_end - 1] == ' ')
+            type_end--;
+
+        if (slice_eql_nocase((Slice){accept->ptr + pos, type_end - pos}, CONTENT_TYPE_BINARY))
+            return true;
+        pos = item_end + 1;
+    }
+    return false;
+}
+
+/// Parse range query: optional date_start and date_end in Unix milliseconds, downsampling parameters, tier,
+/// paging parameters and response format, and plan logs to read.
+/// Return 0 on success, -1 if the request is invalid.
+int parse_range_query(const HttpRequest *request, RangeQuery *query)
+{
+    // Times stay in Unix milliseconds down to the storage, as calendar conversions are not thread-safe
+    int start_res = parse_http_param_i64(request, "date_start", &query->start_ms);
+    int end_res = parse_http_param_i64(request, "date_end", &query->end_ms);
+    if (start_res == -1 || end_res == -1) {
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Invalid date_start or date_end\"");
+        return -1;
+    }
+    if (start_res == 0)
+        query->start_ms = INT64_MIN;
+    if (end_res == 0)
+        query->end_ms = INT64_MAX;
+
+    if (parse_downsample_params(request, &query->max_points, &query->mode) == -1) {
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Invalid downsampling parameters\"");
+        return -1;
+    }
+
+    if (parse_tier_param(request, &query->tier) == -1) {
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Invalid tier\"");
+        return -1;
+    }
+    query->plan =
+        plan_tiers(query->start_ms, query->end_ms, (i64)(get_secs() * 1000), query->max_points, query->tier);
+
+    // Downsampled pages wouldn't join into one series, so paging is only for raw entries.
+    // Cursor of another plan is not from this query, so it can't tell where to resume.
+    if (parse_page_params(request, &query->limit, &query->after) == -1 ||
+        (query->limit > 0 && query->max_points > 0) ||
+        (query->after.tier != -1 &&
+         (query->after.tier < query->plan.finest || query->after.tier > query->plan.coarsest))) {
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Invalid paging parameters\"");
+        return -1;
+    }
+
+    query->format = is_binary_accepted(request) ? RESPONSE_BINARY : RESPONSE_JSON;
+    return 0;
+}
+
+/// Fill cache key of the query, normalized so that equal responses have equal keys.
+void init_cache_key(CacheKey *key, const RangeQuery *query)
+{
+    memset(key, 0, sizeof(CacheKey));
+    key->start_ms = query->start_ms;
+    key->end_ms = query->end_ms;
+    key->max_points = query->max_points;
+    key->limit = query->limit;
+    key->after_tier = query->after.tier;
+    key->after_ms = query->after.ts_ms;
+    key->after_id = query->after.id;
+    key->mode = query->max_points > 0 ? query->mode : DOWNSAMPLE_LTTB;
+    key->format = query->format;
+    key->finest_tier = query->plan.finest;
+    key->preferred_tier = query->plan.preferred;
+    key->coarsest_tier = query->plan.coarsest;
+}
+
+/// Compute 64-bit FNV-1a hash of len bytes at data, continuing from hash.
+u64 hash_bytes(u64 hash, const void *data, usize len)
+{
+    const u8 *bytes = data;
+    for (usize i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/// Read versions of the logs and compute entity tag of the query response from the versions of planned logs.
+void get_query_version(Log **logs, const RangeQuery *query, QueryVersion *version)
+{
+    memset(version, 0, sizeof(QueryVersion));
+    version->is_known = true;
+    for (int i = 0; i < 3; i++) {
+        if (get_log_version(logs[i], &version->logs[i]) == -1)
+            version->is_known = false;
+    }
+    if (!version->is_known)
+        return;
+
+    CacheKey key;
+    init_cache_key(&key, query);
+    u64 hash = hash_bytes(0xcbf29ce484222325ULL, &key, sizeof(key));
+    for (int i = query->plan.finest; i <= query->plan.coarsest; i++)
+        hash = hash_bytes(hash, &version->logs[i], sizeof(LogVersion));
+
+    snprintf(version->etag, sizeof(version->etag), ETAG_FSTRING, (unsigned long long)hash);
+    snprintf(version->etag_header, sizeof(version->etag_header), ETAG_HEADER_FSTRING, version->etag);
+}
+
+/// Check if any entity tag in If-None-Match header matches etag, using weak comparison.
+bool is_etag_matched(const HttpRequest *request, const char *etag)
+{
+    const Slice *header = find_http_header(request, "If-None-Match");
+    if (header == NULL)
+        return false;
+
+    // Value is "*" or a list of tags, e.g. W/"1f2e", "3d4c"
+    for (usize pos = 0; pos < header->len;) {
+        usize tag_end = pos;
+        while (tag_end < header->len && header->ptr[tag_end] != ',')
+            tag_end++;
+        while (pos < tag_end && header->ptr[pos] == ' ')
+            pos++;
+        usize tag_last = tag_end;
+        while (tag_last > pos && header->ptr[tag_last - 1] == ' ')
+            tag_last--;
+        if (tag_last - pos >= 2 && memcmp(header->ptr + pos, "W/", 2) == 0)
+            pos += 2;
+
+        Slice tag = {header->ptr + pos, tag_last - pos};
+        if (slice_eql_nocase(tag, "*"))
+            return true;
+        if (tag.len == strlen(etag) && memcmp(tag.ptr, etag, tag.len) == 0)
+            return true;
+        pos = tag_end + 1;
+    }
+    return false;
+}
+
+void set_not_modified_response(Connection *conn, const QueryVersion *version)
+{
+    int n = snprintf(conn->header, RESPONSE_HEADER_MAX_LEN, NOT_MODIFIED_FSTRING, version->etag,
+                     get_connection_header(conn->keep_alive));
+    assert(n < RESPONSE_HEADER_MAX_LEN);
+    conn->header_len = n;
+    conn->body = NULL;
+    conn->body_len = 0;
+}
+
+/// Run query which needs all the entries at once, downsampled or binary one, and create the whole body.
+/// Bodies are cached until any of the logs changes, if the backend can tell log versions. Pages and cut
+/// short bodies are not, as their cursor is not part of the body.
+/// Caller is responsible for freeing the body.
+/// Return body with its length in body_len and position to continue after in next, its tier is -1 if
+/// there is no next page. Return NULL on error, or with next set if there are too many entries
+/// to downsample.
+char *process_request(Log **logs, ResponseCache *cache, const RangeQuery *query, const QueryVersion *version,
+                      usize *body_len, TierPosition *next)
+{
+    next->tier = -1;
+    bool is_cached = version->is_known && query->limit == 0;
+
+    CacheKey key;
+    init_cache_key(&key, query);
+    if (is_cached) {
+        char *body = get_cached_response(cache, &key, sizeof(key), version->logs, sizeof(version->logs),
+                                         body_len);
+        if (body != NULL) {
+            add_counter(&metrics.cache_hits, 1);
+            write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Response served from cache\"");
+            return body;
         }
+        add_counter(&metrics.cache_misses, 1);
+    }
 
-        // TODO: send unix-epoch timestamp instead of this 
-        char date_str[DATE_LEN + 1];
-        print_date(date_str, &array->items[i].date);
+    f64 query_start = get_secs();
+    usize max_entries = query->limit > 0 ? query->limit : RANGE_MAX_ENTRIES;
+    TempArray *array = get_tier_entries(logs, &query->plan, query->start_ms, query->end_ms, &query->after,
+                                        max_entries, next);
+    f64 query_end = get_secs();
+    observe_histogram(&metrics.stages[STAGE_QUERY], query_end - query_start);
+    if (array == NULL)
+        return NULL;
 
-        char temp_str[TEMP_SERIALIZE_LEN + 1];
-        snprintf(temp_str, TEMP_SERIALIZE_LEN + 1, "%lf", array->items[i].temp);
+    char *body = NULL;
+    if (query->max_points > 0 && next->tier != -1) {
+        write_access_log(access_log, ACCESS_LOG_INFO,
+                         "msg=\"Too many entries to downsample\" max_entries=%zu", max_entries);
+        goto end;
+    }
+    if (query->max_points > 0 && downsample_array(array, query->max_points, query->mode) == -1)
+        goto end;
 
-        pos += sprintf(pos, "{\"date\":\"%s\",\"temp\":%s}", date_str, temp_str);
+    body = create_body(array, query->format, body_len);
+    observe_histogram(&metrics.stages[STAGE_SERIALIZE], get_secs() - query_end);
+    if (body == NULL) {
+        write_access_log(access_log, ACCESS_LOG_ERROR, "msg=\"Failed to create response\" entries=%zu",
+                         array->size);
+        goto end;
     }
-    sprintf(pos, "]}");
-    pos += 2;
-    return pos;
+
+    write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Response created\" entries=%zu", array->size);
+    if (is_cached && next->tier == -1)
+        put_cached_response(cache, &key, sizeof(key), version->logs, sizeof(version->logs), body, *body_len);
+
+end:
+    free(array->items);
+    free(array);
+    return body;
 }
 
-char *create_response(TempArray *array)
+/// Check if request is for the metrics.
+bool is_metrics_request(const HttpRequest *request)
 {
-    assert(array != NULL);
+    return request->path.len == strlen(METRICS_PATH) &&
+           memcmp(request->path.ptr, METRICS_PATH, request->path.len) == 0;
+}
 
-    usize json_size = 11 + 50 * count_not_null(array) - 1;
+/// Print all the server metrics and ingestion lag of the logs in Prometheus text format.
+void print_server_metrics(MetricsText *text, Log **logs)
+{
+    print_metrics(text, "# HELP temp_server_request_duration_seconds Time spent in stage of requests.\n"
+                        "# TYPE temp_server_request_duration_seconds histogram\n");
+    for (int i = 0; i < N_STAGES; i++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", STAGE_NAMES[i]);
+        print_histogram(text, "temp_server_request_duration_seconds", labels, &metrics.stages[i]);
+    }
 
-    // HTTP/1.1 200 OK  Content-Length:   Content-Type: application/json; charset=utf-8
-    usize total_size = RESPONSE_HEADER_MAX_LEN + json_size;
+    print_metrics(text, "# HELP temp_server_requests_total Finished requests by response status.\n"
+                        "# TYPE temp_server_requests_total counter\n");
+    for (usize i = 0; i < N_STATUS_CODES; i++)
+        print_metrics(text, "temp_server_requests_total{status=\"%d\"} %llu\n", STATUS_CODES[i],
+                      (unsigned long long)load_counter(&metrics.requests[i]));
+    print_metrics(text, "temp_server_requests_total{status=\"other\"} %llu\n",
+                  (unsigned long long)load_counter(&metrics.requests[N_STATUS_CODES]));
 
-    char *response = malloc(sizeof(char) * (total_size + 1));
-    if (response == NULL) {
-        fprintf(stderr, "Failed to malloc for response string of size %zu", total_size);
+    print_metrics(text,
+                  "# HELP temp_server_aborted_requests_total Requests whose response failed midway.\n"
+                  "# TYPE temp_server_aborted_requests_total counter\n"
+                  "temp_server_aborted_requests_total %llu\n"
+                  "# HELP temp_server_response_bytes_total Bytes sent in responses including headers.\n"
+                  "# TYPE temp_server_response_bytes_total counter\n"
+                  "temp_server_response_bytes_total %llu\n"
+                  "# HELP temp_server_cache_requests_total Lookups of buffered responses in the cache.\n"
+                  "# TYPE temp_server_cache_requests_total counter\n"
+                  "temp_server_cache_requests_total{result=\"hit\"} %llu\n"
+                  "temp_server_cache_requests_total{result=\"miss\"} %llu\n"
+                  "# HELP temp_server_connections Open client connections.\n"
+                  "# TYPE temp_server_connections gauge\n"
+                  "temp_server_connections %lld\n"
+                  "# HELP temp_server_stream_subscribers Clients subscribed to the live stream.\n"
+                  "# TYPE temp_server_stream_subscribers gauge\n"
+                  "temp_server_stream_subscribers %lld\n",
+                  (unsigned long long)load_counter(&metrics.aborted_requests),
+                  (unsigned long long)load_counter(&metrics.response_bytes),
+                  (unsigned long long)load_counter(&metrics.cache_hits),
+                  (unsigned long long)load_counter(&metrics.cache_misses),
+                  (long long)load_gauge(&metrics.connections), (long long)load_gauge(&metrics.subscribers));
+
+    // Empty logs and backends which can't find the newest entry cheaply have no lag
+    print_metrics(text, "# HELP temp_server_ingestion_lag_seconds Age of the newest committed entry of log.\n"
+                        "# TYPE temp_server_ingestion_lag_seconds gauge\n");
+    f64 now = get_secs();
+    for (int i = 0; i < 3; i++) {
+        i64 last_ms;
+        if (get_last_log_time(logs[i], &last_ms) == 1)
+            print_metrics(text, "temp_server_ingestion_lag_seconds{log=\"log%d\"} %.3f\n", i + 1,
+                          now - (f64)last_ms / 1000);
+    }
+}
+
+/// Create body with the metrics.
+/// Return body with its length in body_len, or NULL on error.
+char *create_metrics_body(Log **logs, usize *body_len)
+{
+    char *body = xmalloc(METRICS_MAX_LEN);
+    MetricsText text = {.data = body, .len = 0, .capacity = METRICS_MAX_LEN, .is_truncated = false};
+    print_server_metrics(&text, logs);
+    if (text.is_truncated) {
+        write_access_log(access_log, ACCESS_LOG_ERROR, "msg=\"Metrics don't fit into response\"");
+        free(body);
         return NULL;
     }
 
-    // Print header
-    char *print_pos = response;
-    print_pos += sprintf(response, RESPONSE_HEADER_FSTRING, json_size);
+    *body_len = text.len;
+    return body;
+}
+
+/// Skip n_sent bytes at the start of buffers, which are adjusted in place.
+/// Return number of leading buffers sent whole.
+usize skip_sent_buffers(SendBuffer *buffers, usize n_buffers, usize n_sent)
+{
+    usize i = 0;
+    while (i < n_buffers && n_sent >= buffers[i].len) {
+        n_sent -= buffers[i].len;
+        i++;
+    }
+    if (i < n_buffers) {
+        buffers[i].data = (const char *)buffers[i].data + n_sent;
+        buffers[i].len -= n_sent;
+    }
+    return i;
+}
+
+/// Send the buffers to non-blocking socket as far as it takes them without waiting.
+/// Buffers are adjusted in place as they are sent.
+/// Return number of leading buffers sent whole, -1 on error.
+i64 send_available(Socket socket, SendBuffer *buffers, usize n_buffers)
+{
+    usize first = skip_sent_buffers(buffers, n_buffers, 0); // Empty buffers are skipped
+    while (first < n_buffers) {
+        i64 n = send_buffers(socket, buffers + first, n_buffers - first);
+        if (n == -1 && is_socket_would_block())
+            break;
+        if (n == -1) {
+            write_access_log(access_log, ACCESS_LOG_INFO, "msg=\"Failed to stream response\" error=\"%s\"",
+                             strerror(errno));
+            return -1;
+        }
+        first += skip_sent_buffers(buffers + first, n_buffers - first, n);
+    }
+    return first;
+}
+
+/// Send the buffered part of body as a chunk, along with response header if it's not sent yet,
+/// and the last chunk if is_last is set. The part the socket doesn't take is copied to writer->rest.
+/// Return 0 if the whole chunk is sent, 1 if the socket is full, -1 on error.
+int flush_chunk(ChunkWriter *writer, bool is_last)
+{
+    assert(writer->rest == NULL);
+
+    // Header goes out with the first chunk, small separate send could be held back by Nagle's algorithm
+    SendBuffer buffers[4];
+    usize n_buffers = 0;
+    if (!writer->is_header_sent) {
+        buffers[n_buffers++] = (SendBuffer){writer->header, writer->header_len};
+        writer->is_header_sent = true;
+    }
+
+    char chunk_header[CHUNK_HEADER_MAX_LEN + 1];
+    if (writer->is_chunked && writer->len > 0) {
+        int n = snprintf(chunk_header, sizeof(chunk_header), "%zx\r\n", writer->len);
+        buffers[n_buffers++] = (SendBuffer){chunk_header, n};
+    }
+    buffers[n_buffers++] = (SendBuffer){writer->buf, writer->len};
+    if (writer->is_chunked) {
+        const char *trailer = writer->len > 0 ? "\r\n" LAST_CHUNK : LAST_CHUNK;
+        if (!is_last)
+            trailer = writer->len > 0 ? "\r\n" : "";
+        buffers[n_buffers++] = (SendBuffer){trailer, strlen(trailer)};
+    }
+
+    usize len = 0;
+    for (usize i = 0; i < n_buffers; i++)
+        len += buffers[i].len;
+    writer->len = 0;
+    i64 first = send_available(writer->socket, buffers, n_buffers);
+    if (first == -1)
+        return -1;
 
-    print_pos = print_json(array, print_pos);
+    usize rest_len = 0;
+    for (usize i = first; i < n_buffers; i++)
+        rest_len += buffers[i].len;
+    writer->n_sent += len - rest_len;
+    if (rest_len == 0)
+        return 0;
 
-    *print_pos = '\0';
+    writer->rest = xmalloc(rest_len);
+    writer->rest_len = 0;
+    for (usize i = first; i < n_buffers; i++) {
+        memcpy(writer->rest + writer->rest_len, buffers[i].data, buffers[i].len);
+        writer->rest_len += buffers[i].len;
+    }
+    return 1;
+}
 
-    return response;
+/// Append part of body to the chunk buffer, sending it first if it doesn't fit.
+/// The part is buffered even if the socket gets full.
+/// Return 0 on success, 1 if the socket is full, -1 on error.
+int write_chunk(ChunkWriter *writer, const char *str, usize len)
+{
+    assert(len <= STREAM_CHUNK_SIZE);
+    int res = 0;
+    if (STREAM_CHUNK_SIZE - writer->len < len && (res = flush_chunk(writer, false)) == -1)
+        return -1;
+    memcpy(writer->buf + writer->len, str, len);
+    writer->len += len;
+    return res;
 }
 
-int handle_client(Log **logs, Socket client)
+/// Write the end of body, with cursor of the next page if the query is paged.
+/// Return 0 on success, 1 if the socket is full, -1 on error.
+int write_stream_end(StreamState *stream)
 {
-    TempArray *array = NULL, *array1 = NULL, *array2 = NULL, *array3 = NULL;
-    char *response = NULL;
+    if (stream->query.limit == 0)
+        return write_chunk(&stream->writer, TEMP_JSON_END, strlen(TEMP_JSON_END));
 
-    int retval = 0;
+    char cursor[PAGE_CURSOR_MAX_LEN + 1];
+    if (stream->has_next)
+        print_page_cursor(cursor, &stream->last);
+    char end[sizeof(TEMP_JSON_PAGE_END "\"\"}") + PAGE_CURSOR_MAX_LEN];
+    int n = stream->has_next ? snprintf(end, sizeof(end), TEMP_JSON_PAGE_END "\"%s\"}", cursor)
+                             : snprintf(end, sizeof(end), TEMP_JSON_PAGE_END "null}");
+    return write_chunk(&stream->writer, end, n);
+}
 
-    char request[HTTP_GET_MAX_LEN + 1];
-    i64 n_read = recv(client, request, HTTP_GET_MAX_LEN + 1, 0);
-    if (n_read == -1) {
-        perror("Failed reading from connected client");
-        goto error;
-    }
-    if (n_read == HTTP_GET_MAX_LEN + 1) {
-        fprintf(stderr, "Received invalid request: request too long!\n");
-        respond_error(client, "413", "Content Too Large");
-        goto error;
-    }
-    request[n_read] = '\0';
-
-    fprintf(stderr, "Received request:\n\"\"\"%s\"\"\"\n", request);
-
-    // TODO: this is not a great way to do things, for sure
-    char get_query[HTTP_GET_MAX_LEN + 1];
-    f32 http_ver;
-    int n_match = sscanf(request, "GET %" TO_TEXT(HTTP_GET_MAX_LEN) "s HTTP/%f", get_query, &http_ver);
-    if (n_match != 2) {
-        fprintf(stderr, "Failed to parse request: invalid format!\n");
-        respond_error(client, "400", "Bad Request");
-        goto error;
-    }
-
-    DateTime *date_start_ptr = NULL, *date_end_ptr = NULL;
-    char *unix_start_str = strstr(get_query, "date_start=");
-    if (unix_start_str != NULL) {
-        usize unix_ms;
-        int ms_read = sscanf(unix_start_str + 11, "%zd", &unix_ms);
-        if (ms_read != 1) {
-            fprintf(stderr, "Failed to parse request: invalid date_start!\n");
-            respond_error(client, "400", "Bad Request");
-            goto error;
+/// Continue streamed response of the connection until the socket is full or the response is complete.
+/// Entries are read from the merged log cursors after the last one written, serialized into a fixed-size
+/// buffer which is sent as soon as it fills up, so memory use doesn't depend on the result size.
+/// Once the socket is full, the rest of the chunk is set as body of the connection for the event loop
+/// to send, and the stream stays set to the connection to be continued. Complete or failed stream is freed.
+/// If the query fails before anything is sent, error response is set to the connection instead.
+/// Return 0 on success, -1 if the response failed midway and the connection has to be closed.
+int continue_stream(Log **logs, Connection *conn)
+{
+    StreamState *stream = conn->stream;
+    ChunkWriter *writer = &stream->writer;
+    const RangeQuery *query = &stream->query;
+    f64 start = get_secs();
+
+    int res = 0;
+    if (!stream->is_drained) {
+        const TierPosition *after = stream->last.tier != -1 ? &stream->last : &query->after;
+        TierCursor *cursor = open_tier_cursor(logs, &query->plan, query->start_ms, query->end_ms, after);
+        if (cursor == NULL)
+            res = -1;
+
+        usize limit = query->limit > 0 ? query->limit : SIZE_MAX;
+        TempEntry entry;
+        int next_res = 0;
+        while (res == 0 && (next_res = next_tier_entry(cursor, &entry)) == 1) {
+            if (stream->n_entries == limit) { // Entry of the next page
+                stream->has_next = true;
+                break;
+            }
+            char entry_str[TEMP_JSON_ENTRY_MAX_LEN + 1];
+            char *pos = entry_str;
+            if (stream->n_entries++ > 0) // Insert comma between each entry
+                *pos++ = ',';
+            pos = print_temp_json_entry(pos, &entry);
+            res = write_chunk(writer, entry_str, pos - entry_str);
+            get_tier_position(cursor, &stream->last);
         }
-        DateTime date_start;
-        get_datetime_from_secs(&date_start, (f64) unix_ms / 1000);
-        date_start_ptr = &date_start;
-    }
-
-    char *unix_end_str = strstr(get_query, "date_end=");
-    if (unix_end_str != NULL) {
-        usize unix_ms;
-        int ms_read = sscanf(unix_end_str + 9, "%zd", &unix_ms);
-        if (ms_read != 1) {
-            fprintf(stderr, "Failed to parse request: invalid date_end format!\n");
-            respond_error(client, "400", "Bad Request");
-            goto error;
+        if (next_res == -1)
+            res = -1;
+        if (cursor != NULL)
+            close_tier_cursor(cursor);
+
+        if (res == 0) {
+            stream->is_drained = true;
+            res = write_stream_end(stream);
         }
-        DateTime date_start;
-        get_datetime_from_secs(&date_start, (f64) unix_ms / 1000);
-        date_end_ptr = &date_start;
     }
 
-    array1 = get_array_entries(logs[0], date_start_ptr, date_end_ptr);
-    array2 = get_array_entries(logs[1], date_start_ptr, date_end_ptr);
-    array3 = get_array_entries(logs[2], date_start_ptr, date_end_ptr);
-    if (array1 == NULL || array2 == NULL || array3 == NULL) {
-        respond_server_error(client);
-        goto error;
+    bool is_complete = false;
+    if (res == 0) {
+        res = flush_chunk(writer, true);
+        is_complete = res != -1;
     }
 
-    array = xmalloc(sizeof(TempArray));
+    stream->stream_secs += get_secs() - start;
+    conn->bytes_streamed = writer->n_sent;
+    if (writer->rest != NULL) {
+        conn->body = writer->rest;
+        conn->body_len = writer->rest_len;
+        conn->response_sent = 0;
+        writer->rest = NULL;
+    }
+    if (res == 1 && !is_complete)
+        return 0;
 
-    usize sum_size = array1->size + array2->size + array3->size;
-    array->items = malloc(sizeof(TempEntry) * sum_size);
-    if (array->items == NULL) {
-        fprintf(stderr, "Failed to malloc for %zu entries: %s (%d)\n", sum_size, strerror(errno), errno);
-        respond_server_error(client);
-        goto end;
+    observe_histogram(&metrics.stages[STAGE_STREAM], stream->stream_secs);
+    if (res == -1 && !writer->is_header_sent) {
+        set_server_error_response(conn);
+        res = 0;
+    } else if (res != -1) {
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Response streamed\" entries=%zu",
+                         stream->n_entries);
     }
+    free(stream);
+    conn->stream = NULL;
+    return res == -1 ? -1 : 0;
+}
 
-    usize n1 = array1->size * sizeof(TempEntry);
-    memcpy(array->items, array1->items, n1);
-    usize n2 = array2->size * sizeof(TempEntry);
-    memcpy(&array->items[array1->size], array2->items, n2);
-    usize n3 = array3->size * sizeof(TempEntry);
-    memcpy(&array->items[array1->size + array2->size], array3->items, n3);
+/// Start streaming all the entries of the query, or of its page, to the client.
+/// HTTP/1.1 clients get chunked body, HTTP/1.0 clients read the body until the connection is closed.
+/// Return 0 on success, -1 if the response failed midway and the connection has to be closed.
+int stream_response(Log **logs, const RangeQuery *query, const QueryVersion *version, Connection *conn)
+{
+    StreamState *stream = xmalloc(sizeof(StreamState));
+    stream->query = *query;
+    stream->last = (TierPosition){.tier = -1, .ts_ms = INT64_MIN, .id = 0};
+    stream->n_entries = 0;
+    stream->has_next = false;
+    stream->is_drained = false;
+    stream->stream_secs = 0;
 
-    array->size = sum_size;
+    ChunkWriter *writer = &stream->writer;
+    writer->socket = conn->socket;
+    writer->is_chunked = conn->http.version_minor >= 1;
+    writer->is_header_sent = false;
+    writer->len = 0;
+    writer->n_sent = 0;
+    writer->rest = NULL;
+    writer->rest_len = 0;
+    if (!writer->is_chunked)
+        conn->keep_alive = false;
 
-    response = create_response(array);
-    if (response == NULL) {
-        fprintf(stderr, "Failed to create response with array of size %zu!\n", sum_size);
-        respond_server_error(client);
-        goto end;
+    writer->header_len = snprintf(writer->header, RESPONSE_HEADER_MAX_LEN, STREAM_HEADER_FSTRING,
+                                  writer->is_chunked ? TRANSFER_ENCODING_CHUNKED : "", version->etag_header,
+                                  get_connection_header(conn->keep_alive));
+    assert(writer->header_len < RESPONSE_HEADER_MAX_LEN);
+
+    // Empty buffer takes the start without sending anything
+    write_chunk(writer, TEMP_JSON_START, strlen(TEMP_JSON_START));
+    conn->stream = stream;
+    return continue_stream(logs, conn);
+}
+
+/// Answer range query with empty 304 response if the client has the current one already.
+/// Otherwise entries are streamed to the socket right away unless downsampling or binary format is requested,
+/// which need all of them at once.
+void serve_range_query(Log **logs, ResponseCache *cache, const RangeQuery *query, Connection *conn)
+{
+    QueryVersion version;
+    get_query_version(logs, query, &version);
+    if (version.is_known && is_etag_matched(&conn->http, version.etag)) {
+        set_not_modified_response(conn, &version);
+    } else if (query->max_points > 0 || query->format == RESPONSE_BINARY) {
+        usize body_len;
+        TierPosition next;
+        char *body = process_request(logs, cache, query, &version, &body_len, &next);
+        if (body != NULL) {
+            char headers[ETAG_HEADER_MAX_LEN + NEXT_AFTER_HEADER_MAX_LEN];
+            int n = snprintf(headers, sizeof(headers), "%s", version.etag_header);
+            if (next.tier != -1) {
+                char cursor[PAGE_CURSOR_MAX_LEN + 1];
+                print_page_cursor(cursor, &next);
+                snprintf(headers + n, sizeof(headers) - n, NEXT_AFTER_HEADER_FSTRING, cursor);
+            }
+            set_body_response(conn, body, body_len, get_content_type(query->format), headers);
+        } else if (next.tier != -1) {
+            set_error_response(conn, "413", "Content Too Large");
+        } else {
+            set_server_error_response(conn);
+        }
+    } else if (stream_response(logs, query, &version, conn) == -1) {
+        conn->is_broken = true;
     }
+}
 
-    if (respond_client(client, response) != -1)
-        fprintf(stderr, "Request parsed successfully, response send:\n\"\"\"%s\"\"\"\n", response);
+/// Handle the request of the connection in worker: range query entries may be streamed to the socket
+/// right away, otherwise buffered response is set to the connection for the event loop to send.
+/// Streamed response handed to the event loop midway is continued instead.
+void serve_request(Log **logs, ResponseCache *cache, Connection *conn)
+{
+    if (conn->stream != NULL) {
+        if (continue_stream(logs, conn) == -1)
+            conn->is_broken = true;
+        return;
+    }
 
-end:
-    if (array != NULL) {
-        if (array->items != NULL)
-            free(array->items);
-        free(array);
+    const HttpRequest *request = &conn->http;
+    conn->header_len = 0;
+    conn->body = NULL;
+    conn->body_len = 0;
+    conn->response_sent = 0;
+
+    RangeQuery query;
+    if (!slice_eql_nocase(request->method, "GET")) {
+        set_error_response(conn, "405", "Method Not Allowed");
+    } else if (is_metrics_request(request)) {
+        usize body_len;
+        char *body = create_metrics_body(logs, &body_len);
+        if (body != NULL)
+            set_body_response(conn, body, body_len, CONTENT_TYPE_METRICS, "");
+        else
+            set_server_error_response(conn);
+    } else if (parse_range_query(request, &query) == -1) {
+        set_error_response(conn, "400", "Bad Request");
+    } else {
+        serve_range_query(logs, cache, &query, conn);
     }
+}
 
-    if (response != NULL)
-        free(response);
+void init_conn_queue(ConnQueue *queue)
+{
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->is_closed = false;
+    queue->len = 0;
+    init_mutex(&queue->mutex);
+    init_cond(&queue->not_empty);
+}
 
-    if (array1 != NULL)
-        free(array1);
-    if (array2 != NULL)
-        free(array2);
-    if (array3 != NULL)
-        free(array3);
+void deinit_conn_queue(ConnQueue *queue)
+{
+    destroy_cond(&queue->not_empty);
+    destroy_mutex(&queue->mutex);
+}
 
-    close_socket(client);
-    return retval;
-error:
-    retval = -1;
-    goto end;
+/// Add connection to the end of the queue and wake up a thread waiting for it.
+void push_conn(ConnQueue *queue, Connection *conn)
+{
+    lock_mutex(&queue->mutex);
+    conn->next = NULL;
+    if (queue->tail != NULL)
+        queue->tail->next = conn;
+    else
+        queue->head = conn;
+    queue->tail = conn;
+    queue->len++;
+    signal_cond(&queue->not_empty);
+    unlock_mutex(&queue->mutex);
 }
 
-int main(int argc, char **argv)
+/// Take the first connection from the queue.
+/// If wait is set, wait until there is one or the queue is closed.
+/// Return NULL if the queue is empty.
+Connection *pop_conn(ConnQueue *queue, bool wait)
 {
-#ifndef USEDB
-    fprintf(stderr, "HTTP server without database is not supported.\n");
-    exit(2);
-#endif
-    if (argc != 2) {
-        fprintf(stderr, "Usage: temp_server LOG_PATH\n");
-        exit(2);
+    lock_mutex(&queue->mutex);
+    while (wait && queue->head == NULL && !queue->is_closed)
+        wait_cond(&queue->not_empty, &queue->mutex);
+
+    Connection *conn = queue->head;
+    if (conn != NULL) {
+        queue->head = conn->next;
+        if (queue->head == NULL)
+            queue->tail = NULL;
+        queue->len--;
     }
+    unlock_mutex(&queue->mutex);
+    return conn;
+}
 
-#ifndef WIN32
-    signal(SIGPIPE, SIG_IGN);
-#endif
-    signal(SIGINT, sigint_handler);
+void close_conn_queue(ConnQueue *queue)
+{
+    lock_mutex(&queue->mutex);
+    queue->is_closed = true;
+    broadcast_cond(&queue->not_empty);
+    unlock_mutex(&queue->mutex);
+}
 
-    char *db_path = argv[1];
+usize get_conn_queue_len(ConnQueue *queue)
+{
+    lock_mutex(&queue->mutex);
+    usize len = queue->len;
+    unlock_mutex(&queue->mutex);
+    return len;
+}
+
+bool is_conn_queue_closed(ConnQueue *queue)
+{
+    lock_mutex(&queue->mutex);
+    bool is_closed = queue->is_closed;
+    unlock_mutex(&queue->mutex);
+    return is_closed;
+}
+
+void *worker_main(void *arg)
+{
+    Worker *worker = arg;
+    Server *server = worker->server;
+
+    LogStorage *storage = open_log_storage_readonly(worker->db_path);
     Log *logs[3];
     for (int i = 0; i < 3; i++)
-        logs[i] = init_log(db_path, LOG_ARGS[i]);
+        logs[i] = init_log(storage, LOG_ARGS[i]);
+
+    Connection *conn;
+    while ((conn = pop_conn(&server->requests, true)) != NULL) {
+        if (conn->stream == NULL) // Continued stream keeps the time its query started
+            conn->query_start = get_secs();
+        serve_request(logs, server->cache, conn);
+        conn->query_end = get_secs();
+        push_conn(&server->responses, conn);
+
+        // Wake up the event loop. If the pair is full, a wake up is pending already.
+        send(server->wake_pair[1], "", 1, 0);
+    }
+
+    int res = 0;
+    for (int i = 0; i < 3; i++)
+        res |= deinit_log(logs[i]);
+    res |= close_log_storage(storage);
+    if (res != 0)
+        fprintf(stderr, "Failed to deinit logs of worker!\n");
+
+    return NULL;
+}
+
+/// Check if request is for the live stream.
+bool is_stream_request(const HttpRequest *request)
+{
+    return slice_eql_nocase(request->method, "GET") && request->path.len == strlen(STREAM_PATH) &&
+           memcmp(request->path.ptr, STREAM_PATH, request->path.len) == 0;
+}
+
+/// Parse Last-Event-ID header of resuming client, ids of the last rows of all the logs as "1,2,3".
+/// Return 0 on success, -1 if there is no such header or it's invalid.
+int parse_last_event_id(const HttpRequest *request, i64 ids[3])
+{
+    const Slice *value = find_http_header(request, "Last-Event-ID");
+    if (value == NULL)
+        return -1;
+
+    usize pos = 0;
+    for (int i = 0; i < 3; i++) {
+        if (i > 0 && (pos == value->len || value->ptr[pos++] != ','))
+            return -1;
+
+        // At most 18 digits are read, so the id can't overflow
+        usize start = pos;
+        ids[i] = 0;
+        while (pos < value->len && pos - start < 18 && value->ptr[pos] >= '0' && value->ptr[pos] <= '9')
+            ids[i] = ids[i] * 10 + (value->ptr[pos++] - '0');
+        if (pos == start)
+            return -1;
+    }
+    return pos == value->len ? 0 : -1;
+}
+
+/// Print event with the non-null entries of the log with ids in (after_id, ids[log_index]] to hub->event,
+/// ids of the other logs are the ones the client got already.
+/// Return event length, 0 if there are no such entries, -1 on error.
+i64 print_stream_event(StreamHub *hub, Log *log, int log_index, i64 after_id, const i64 ids[3])
+{
+    assert(ids[log_index] - after_id <= SSE_EVENT_MAX_ENTRIES);
+
+    LogCursor *cursor = open_log_cursor_by_id(log, after_id, ids[log_index]);
+    if (cursor == NULL)
+        return -1;
+
+    char *pos = hub->event;
+    pos += sprintf(pos, "event: tier%d\nid: ", log_index + 1);
+    for (int i = 0; i < 3; i++) {
+        if (i > 0)
+            *pos++ = ',';
+        pos = print_json_i64(pos, ids[i]);
+    }
+    memcpy(pos, "\ndata: [", strlen("\ndata: ["));
+    pos += strlen("\ndata: [");
+
+    // Row ids are unique, so there are at most SSE_EVENT_MAX_ENTRIES of them
+    usize n_entries = 0;
+    TempEntry entry;
+    int res;
+    while ((res = next_log_entry(cursor, &entry)) == 1) {
+        if (is_entry_null(&entry))
+            continue;
+        if (n_entries++ > 0)
+            *pos++ = ',';
+        pos = print_temp_json_entry(pos, &entry);
+    }
+    close_log_cursor(cursor);
+    if (res == -1)
+        return -1;
+    if (n_entries == 0)
+        return 0;
+
+    memcpy(pos, "]\n\n", strlen("]\n\n"));
+    pos += strlen("]\n\n");
+    return pos - hub->event;
+}
 
-    Socket server_socket = open_socket_tcp();
-    if (server_socket == (Socket)-1) {
+/// Send the buffer to subscriber without blocking. The part the socket doesn't take is passed to the event
+/// loop to send, along with ids of the last rows the subscriber has with the buffer, to continue from them
+/// once the subscriber joins the hub again.
+/// Return 0 if the whole buffer is sent, 1 if subscriber is passed to the event loop, -1 on error.
+int send_to_subscriber(StreamHub *hub, Connection *conn, const char *buf, usize len, const i64 ids[3])
+{
+    i64 n = send_buffers(conn->socket, &(SendBuffer){buf, len}, 1);
+    if (n == -1 && !is_socket_would_block()) {
+        write_access_log(access_log, ACCESS_LOG_INFO,
+                         "msg=\"Failed to send event to subscriber\" error=\"%s\"", strerror(errno));
+        return -1;
+    }
+    if (n == -1)
+        n = 0;
+    conn->bytes_streamed += n;
+    if (n == (i64)len)
+        return 0;
+
+    conn->header_len = 0;
+    conn->body = xmalloc(len - n);
+    memcpy(conn->body, buf + n, len - n);
+    conn->body_len = len - n;
+    conn->response_sent = 0;
+    memcpy(conn->event_ids, ids, sizeof(conn->event_ids));
+    push_conn(&hub->server->responses, conn);
+    send(hub->server->wake_pair[1], "", 1, 0);
+    return 1;
+}
+
+/// Pass subscriber to the event loop to be closed.
+/// is_broken is set if the stream failed, otherwise the client left and the request ended as usual.
+void drop_subscriber(StreamHub *hub, Connection *conn, bool is_broken)
+{
+    if (is_broken)
+        conn->is_broken = true;
+    else
+        conn->is_unsubscribed = true;
+    push_conn(&hub->server->responses, conn);
+    send(hub->server->wake_pair[1], "", 1, 0);
+}
+
+/// Send the buffer to all the subscribers, which have the rows up to ids with it.
+/// Subscribers passed to the event loop or failed are removed.
+void broadcast_event(StreamHub *hub, const char *buf, usize len, const i64 ids[3])
+{
+    // Removing moves the last subscriber in place of the removed one, so iterate from the end.
+    for (usize i = hub->n_subscribers; i > 0; i--) {
+        Connection *conn = hub->subscribers[i - 1];
+        int res = send_to_subscriber(hub, conn, buf, len, ids);
+        if (res == 0)
+            continue;
+
+        hub->subscribers[i - 1] = hub->subscribers[--hub->n_subscribers];
+        if (res == -1)
+            drop_subscriber(hub, conn, false);
+    }
+}
+
+/// Send entries of the logs with ids in (ids, last_ids] as events, to conn or to all the subscribers
+/// if it's NULL. ids are advanced as events are sent. conn is dropped if sending to it fails.
+/// Return 0 if all the events are sent, 1 if conn is passed to the event loop or dropped midway,
+/// -1 if reading the logs fails.
+int send_new_entries(StreamHub *hub, Log **logs, Connection *conn, i64 ids[3], const i64 last_ids[3])
+{
+    for (int i = 0; i < 3; i++) {
+        while (ids[i] < last_ids[i]) {
+            i64 after_id = ids[i];
+            ids[i] = last_ids[i] - after_id > SSE_EVENT_MAX_ENTRIES ? after_id + SSE_EVENT_MAX_ENTRIES
+                                                                   : last_ids[i];
+            i64 len = print_stream_event(hub, logs[i], i, after_id, ids);
+            if (len == -1) {
+                ids[i] = after_id;
+                return -1;
+            }
+            if (len == 0)
+                continue;
+
+            if (conn == NULL) {
+                broadcast_event(hub, hub->event, len, ids);
+                continue;
+            }
+            int res = send_to_subscriber(hub, conn, hub->event, len, ids);
+            if (res == -1)
+                drop_subscriber(hub, conn, false);
+            if (res != 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/// Push entries committed since the last poll to all the subscribers.
+void poll_new_entries(StreamHub *hub, Log **logs)
+{
+    i64 last_ids[3];
+    for (int i = 0; i < 3; i++) {
+        LogVersion version;
+        if (get_log_version(logs[i], &version) == -1)
+            return;
+        last_ids[i] = version.max_id;
+        if (hub->last_ids[i] > last_ids[i]) // Log was recreated
+            hub->last_ids[i] = last_ids[i];
+    }
+
+    // Nobody to send to, so only skip to the newest rows
+    if (hub->n_subscribers == 0) {
+        memcpy(hub->last_ids, last_ids, sizeof(last_ids));
+        return;
+    }
+    if (send_new_entries(hub, logs, NULL, hub->last_ids, last_ids) == -1)
+        write_access_log(access_log, ACCESS_LOG_ERROR, "msg=\"Failed to read new entries for subscribers\"");
+}
+
+/// Answer stream request with event stream header and entries the client missed if it resumes,
+/// then subscribe it to new entries. Subscriber joining again after the event loop sent the rest of its event
+/// gets the entries committed meanwhile.
+void add_subscriber(StreamHub *hub, Log **logs, Connection *conn)
+{
+    if (hub->n_subscribers == SSE_MAX_SUBSCRIBERS) {
+        write_access_log(access_log, ACCESS_LOG_ERROR, "msg=\"Too many subscribers, rejecting client\"");
+        if (conn->is_subscribed) { // Too late for an error response
+            drop_subscriber(hub, conn, true);
+            return;
+        }
+        set_error_response(conn, "503", "Service Unavailable");
+        conn->response_sent = 0;
+        push_conn(&hub->server->responses, conn);
+        send(hub->server->wake_pair[1], "", 1, 0);
+        return;
+    }
+
+    // Clients which don't resume get only entries committed from now on
+    i64 ids[3];
+    bool is_resuming = conn->is_subscribed || parse_last_event_id(&conn->http, ids) == 0;
+    if (conn->is_subscribed)
+        memcpy(ids, conn->event_ids, sizeof(ids));
+    for (int i = 0; i < 3; i++) {
+        if (!is_resuming || ids[i] > hub->last_ids[i])
+            ids[i] = hub->last_ids[i];
+        else if (!conn->is_subscribed && hub->last_ids[i] - ids[i] > SSE_MAX_RESUME_ENTRIES)
+            ids[i] = hub->last_ids[i] - SSE_MAX_RESUME_ENTRIES;
+    }
+
+    if (!conn->is_subscribed) {
+        conn->query_start = get_secs();
+        conn->query_end = conn->query_start;
+        conn->is_subscribed = true;
+        add_gauge(&metrics.subscribers, 1);
+        write_access_log(access_log, ACCESS_LOG_INFO,
+                         "msg=\"Client subscribed to live stream\" subscribers=%zu", hub->n_subscribers + 1);
+
+        int res = send_to_subscriber(hub, conn, SSE_HEADER, strlen(SSE_HEADER), ids);
+        if (res == -1)
+            drop_subscriber(hub, conn, true);
+        if (res != 0)
+            return;
+    }
+
+    int res = send_new_entries(hub, logs, conn, ids, hub->last_ids);
+    if (res == -1)
+        drop_subscriber(hub, conn, true);
+    if (res != 0)
+        return;
+    hub->subscribers[hub->n_subscribers++] = conn;
+}
+
+void *hub_main(void *arg)
+{
+    StreamHub *hub = arg;
+
+    LogStorage *storage = open_log_storage_readonly(hub->db_path);
+    Log *logs[3];
+    for (int i = 0; i < 3; i++)
+        logs[i] = init_log(storage, LOG_ARGS[i]);
+
+    hub->last_heartbeat = get_secs();
+    while (!is_conn_queue_closed(&hub->joining)) {
+        // New subscribers wake the hub up early, so they don't wait for the poll period
+        wait_socket_readable(hub->wake_pair[0], SSE_POLL_PERIOD_MS);
+        char buf[64];
+        while (recv(hub->wake_pair[0], buf, sizeof(buf), 0) > 0)
+            ;
+
+        // Joining clients are answered after the poll, so they get entries up to the same ids as the others
+        poll_new_entries(hub, logs);
+        Connection *conn;
+        while ((conn = pop_conn(&hub->joining, false)) != NULL)
+            add_subscriber(hub, logs, conn);
+
+        f64 now = get_secs();
+        if (now - hub->last_heartbeat >= SSE_HEARTBEAT_SECS) {
+            broadcast_event(hub, SSE_HEARTBEAT, strlen(SSE_HEARTBEAT), hub->last_ids);
+            hub->last_heartbeat = now;
+        }
+    }
+
+    int res = 0;
+    for (int i = 0; i < 3; i++)
+        res |= deinit_log(logs[i]);
+    res |= close_log_storage(storage);
+    if (res != 0)
+        fprintf(stderr, "Failed to deinit logs of stream hub!\n");
+
+    return NULL;
+}
+
+/// Open wake up pair of the hub and start its thread, subscribers are left in the server connections.
+/// Exit with code 1 on failure.
+StreamHub *start_stream_hub(Server *server, const char *db_path)
+{
+    StreamHub *hub = xmalloc(sizeof(StreamHub));
+    hub->db_path = db_path;
+    hub->server = server;
+    hub->n_subscribers = 0;
+    memset(hub->last_ids, 0, sizeof(hub->last_ids));
+    init_conn_queue(&hub->joining);
+
+    if (open_socket_pair(hub->wake_pair) == -1 || set_socket_nonblocking(hub->wake_pair[0]) == -1 ||
+        set_socket_nonblocking(hub->wake_pair[1]) == -1) {
+        perror("Failed to open stream hub wake up socket pair");
+        exit(1);
+    }
+
+    usize err = start_thread(&hub->thread, hub_main, hub);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start stream hub thread: %s (%zu)\n", strerror(err), err);
+        exit(1);
+    }
+    return hub;
+}
+
+/// Stop the hub thread and free it, its subscribers are closed with the rest of the server connections.
+void stop_stream_hub(StreamHub *hub)
+{
+    close_conn_queue(&hub->joining);
+    send(hub->wake_pair[1], "", 1, 0);
+    join_thread(hub->thread);
+
+    close_socket(hub->wake_pair[0]);
+    close_socket(hub->wake_pair[1]);
+    deinit_conn_queue(&hub->joining);
+    free(hub);
+}
+
+/// Set events the connection socket is watched for, 0 to stop watching it.
+/// Return 0 on success, -1 on error.
+int watch_conn(Server *server, Connection *conn, u32 events)
+{
+    int res = 0;
+    if (events == conn->poll_events)
+        return 0;
+    else if (events == 0)
+        res = remove_poll_socket(server->poller, conn->socket);
+    else if (conn->poll_events != 0)
+        res = modify_poll_socket(server->poller, conn->socket, events, conn);
+    else
+        res = add_poll_socket(server->poller, conn->socket, events, conn);
+
+    if (res == -1)
+        write_access_log(access_log, ACCESS_LOG_ERROR, "msg=\"Failed to watch client socket\" error=\"%s\"",
+                         strerror(errno));
+    else
+        conn->poll_events = events;
+    return res;
+}
+
+void close_conn(Server *server, Connection *conn)
+{
+    watch_conn(server, conn, 0);
+    close_socket(conn->socket);
+
+    server->n_conns--;
+    add_gauge(&metrics.connections, -1);
+    server->conns[conn->slot] = server->conns[server->n_conns];
+    server->conns[conn->slot]->slot = conn->slot;
+    if (conn->is_subscribed)
+        add_gauge(&metrics.subscribers, -1);
+
+    free(conn->body);
+    free(conn->stream);
+    free(conn);
+}
+
+/// Check if client wants to keep connection open after the response to the request:
+/// HTTP/1.1 does unless it sends "Connection: close", HTTP/1.0 only if it sends "Connection: keep-alive".
+bool is_keep_alive_request(const HttpRequest *request)
+{
+    bool keep_alive = request->version_minor >= 1;
+    for (usize i = 0; i < request->n_headers; i++) {
+        if (!slice_eql_nocase(request->headers[i].name, "Connection"))
+            continue;
+
+        // Value is a list of tokens, e.g. "keep-alive, Upgrade"
+        Slice value = request->headers[i].value;
+        for (usize pos = 0; pos < value.len;) {
+            usize token_end = pos;
+            while (token_end < value.len && value.ptr[token_end] != ',')
+                token_end++;
+            usize token_start = pos;
+            while (token_start < token_end && value.ptr[token_start] == ' ')
+                token_start++;
+            usize token_last = token_end;
+            while (token_last > token_start && value.ptr[token_last - 1] == ' ')
+                token_last--;
+
+            Slice token = {value.ptr + token_start, token_last - token_start};
+            if (slice_eql_nocase(token, "close"))
+                keep_alive = false;
+            else if (slice_eql_nocase(token, "keep-alive"))
+                keep_alive = true;
+            pos = token_end + 1;
+        }
+    }
+    return keep_alive;
+}
+
+/// Count the current request in metrics once its response is finished or aborted.
+/// Live stream requests only last until the client leaves, so their durations are not observed.
+void observe_request(const Connection *conn, bool is_aborted, f64 now)
+{
+    int status = conn->header_len > 0 ? atoi(conn->header + strlen("HTTP/1.1 ")) : 200;
+    usize status_index = 0;
+    while (status_index < N_STATUS_CODES && STATUS_CODES[status_index] != status)
+        status_index++;
+    add_counter(&metrics.requests[status_index], 1);
+    if (is_aborted)
+        add_counter(&metrics.aborted_requests, 1);
+    add_counter(&metrics.response_bytes,
+                conn->header_len > 0 ? conn->response_sent : conn->bytes_streamed + conn->response_sent);
+
+    if (conn->is_subscribed)
+        return;
+    observe_histogram(&metrics.stages[STAGE_QUEUE], conn->query_start - conn->dispatch_time);
+    if (conn->header_len > 0)
+        observe_histogram(&metrics.stages[STAGE_SEND], now - conn->query_end);
+    observe_histogram(&metrics.stages[STAGE_TOTAL], now - conn->dispatch_time);
+}
+
+/// Write access log line of the current request once its response is finished or aborted,
+/// and the request and the response themselves on debug level. The request is counted in metrics as well.
+void log_request(const Connection *conn, bool is_aborted)
+{
+    f64 now = get_secs();
+    observe_request(conn, is_aborted, now);
+
+    if (!is_access_log_enabled(access_log, ACCESS_LOG_INFO))
+        return;
+
+    // Malformed request has no method or target
+    const HttpRequest *request = &conn->http;
+    Slice method = {"-", 1};
+    char target[ACCESS_LOG_PAYLOAD_MAX_LEN] = "";
+    if (request->len > 0) {
+        method = request->method;
+        const char *target_end = request->query.ptr + request->query.len;
+        escape_access_log_value(target, sizeof(target), request->path.ptr, target_end - request->path.ptr);
+    }
+
+    // Streamed responses are 200 OK, unless they failed before sending anything and got error response
+    int status = conn->header_len > 0 ? atoi(conn->header + strlen("HTTP/1.1 ")) : 200;
+    usize n_bytes = conn->header_len > 0 ? conn->response_sent : conn->bytes_streamed + conn->response_sent;
+    write_access_log(access_log, ACCESS_LOG_INFO,
+                     "method=%.*s target=\"%s\" status=%d bytes=%zu queue_ms=%.3f query_ms=%.3f "
+                     "total_ms=%.3f%s",
+                     (int)method.len, method.ptr, target, status, n_bytes,
+                     (conn->query_start - conn->dispatch_time) * 1000,
+                     (conn->query_end - conn->query_start) * 1000, (now - conn->dispatch_time) * 1000,
+                     is_aborted ? " aborted=true" : "");
+
+    if (!is_access_log_enabled(access_log, ACCESS_LOG_DEBUG))
+        return;
+
+    char payload[ACCESS_LOG_PAYLOAD_MAX_LEN];
+    escape_access_log_value(payload, sizeof(payload), conn->request, conn->request_end);
+    write_access_log(access_log, ACCESS_LOG_DEBUG, "payload=request data=\"%s\"", payload);
+    if (conn->header_len > 0) {
+        escape_access_log_value(payload, sizeof(payload), conn->header, conn->header_len);
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "payload=response data=\"%s\"", payload);
+    }
+}
+
+/// Answer request on the event loop with response without body.
+void start_error_response(Server *server, Connection *conn, const char *code, const char *message)
+{
+    conn->state = CONN_WRITING;
+    set_error_response(conn, code, message);
+    conn->response_sent = 0;
+    write_response(server, conn);
+}
+
+/// Pass the first request in the buffer to workers if it is complete, otherwise wait for the rest of it.
+void dispatch_request(Server *server, Connection *conn)
+{
+    // Requests answered on the event loop take no query time
+    conn->dispatch_time = get_secs();
+    conn->query_start = conn->dispatch_time;
+    conn->query_end = conn->dispatch_time;
+    conn->bytes_streamed = 0;
+    conn->response_sent = 0;
+
+    HttpParseResult res = parse_http_request(&conn->http, conn->request, conn->request_len);
+    if (res != HTTP_PARSE_PARTIAL) // Partial requests are parsed again once more data arrives
+        observe_histogram(&metrics.stages[STAGE_PARSE], get_secs() - conn->dispatch_time);
+    if (res == HTTP_PARSE_ERROR) {
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Malformed request\"");
+        conn->keep_alive = false;
+        start_error_response(server, conn, "400", "Bad Request");
+        return;
+    }
+    if (res == HTTP_PARSE_PARTIAL && conn->request_len == HTTP_GET_MAX_LEN) {
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Request too long\"");
+        conn->keep_alive = false;
+        start_error_response(server, conn, "413", "Content Too Large");
+        return;
+    }
+    if (res == HTTP_PARSE_PARTIAL) {
+        if (watch_conn(server, conn, POLL_READ) == -1)
+            close_conn(server, conn);
+        return;
+    }
+
+    conn->request_end = conn->http.len;
+    conn->n_requests++;
+    conn->keep_alive =
+        is_working && conn->n_requests < KEEP_ALIVE_MAX_REQUESTS && is_keep_alive_request(&conn->http);
+
+    // Requests over the limits are shed before they reach workers, so they cost no database work
+    if (!take_rate_token(server->limiter, conn->client_addr, conn->dispatch_time)) {
+        write_access_log(access_log, ACCESS_LOG_DEBUG, "msg=\"Client over rate limit\"");
+        start_error_response(server, conn, "429", "Too Many Requests");
+        return;
+    }
+    if (!is_stream_request(&conn->http) && get_conn_queue_len(&server->requests) >= limits.max_queued) {
+        write_access_log(access_log, ACCESS_LOG_INFO, "msg=\"Too many queued requests, rejecting request\"");
+        start_error_response(server, conn, "503", "Service Unavailable");
+        return;
+    }
+
+    conn->state = CONN_QUERYING;
+    if (watch_conn(server, conn, 0) == -1) {
+        close_conn(server, conn);
+        return;
+    }
+
+    // Event stream doesn't end, so the connection is never reused for other requests
+    if (is_stream_request(&conn->http)) {
+        conn->state = CONN_STREAMING;
+        conn->keep_alive = false;
+        push_conn(&server->hub->joining, conn);
+        send(server->hub->wake_pair[1], "", 1, 0);
+        return;
+    }
+    push_conn(&server->requests, conn);
+}
+
+/// Close connection gracefully: stop sending and discard whatever client sends until it closes connection.
+/// Closing the socket right away with unread pipelined requests in it would reset the connection,
+/// and client could lose the last response.
+void linger_conn(Server *server, Connection *conn)
+{
+    conn->state = CONN_CLOSING;
+    conn->last_active = get_secs();
+    if (shutdown_socket_send(conn->socket) == -1 || watch_conn(server, conn, POLL_READ) == -1)
+        close_conn(server, conn);
+}
+
+/// Close connection once client closes it or fails.
+void read_closing(Server *server, Connection *conn)
+{
+    char buf[HTTP_GET_MAX_LEN];
+    i64 n = recv(conn->socket, buf, sizeof(buf), 0);
+    if (n == -1 && is_socket_would_block())
+        return;
+    if (n <= 0)
+        close_conn(server, conn);
+}
+
+/// Prepare persistent connection for the next request: drop the answered one from the buffer
+/// and dispatch the pipelined one if it's there already, otherwise wait for it.
+void finish_response(Server *server, Connection *conn)
+{
+    log_request(conn, false);
+    if (!conn->keep_alive) {
+        linger_conn(server, conn);
+        return;
+    }
+
+    free(conn->body);
+    conn->header_len = 0;
+    conn->body = NULL;
+    conn->body_len = 0;
+
+    conn->request_len -= conn->request_end;
+    memmove(conn->request, conn->request + conn->request_end, conn->request_len);
+    conn->request[conn->request_len] = '\0';
+    conn->request_end = 0;
+    conn->request_start = get_secs(); // Pipelined request has been received already
+    init_http_request(&conn->http);
+
+    conn->state = CONN_READING;
+    conn->last_active = get_secs();
+    dispatch_request(server, conn);
+}
+
+/// Pass connection back to workers to continue its streamed response, once the event loop has sent the part
+/// of it the socket didn't take before.
+void continue_stream_in_worker(Server *server, Connection *conn)
+{
+    conn->stream->writer.n_sent += conn->response_sent;
+    free(conn->body);
+    conn->body = NULL;
+    conn->body_len = 0;
+    conn->response_sent = 0;
+
+    conn->state = CONN_QUERYING;
+    if (watch_conn(server, conn, 0) == -1) {
+        log_request(conn, true);
+        close_conn(server, conn);
+        return;
+    }
+    push_conn(&server->requests, conn);
+}
+
+/// Pass subscriber back to the hub to continue its live stream, once the event loop has sent the part
+/// of an event the socket didn't take before.
+void continue_stream_in_hub(Server *server, Connection *conn)
+{
+    conn->bytes_streamed += conn->response_sent;
+    free(conn->body);
+    conn->body = NULL;
+    conn->body_len = 0;
+    conn->response_sent = 0;
+
+    conn->state = CONN_STREAMING;
+    if (watch_conn(server, conn, 0) == -1) {
+        log_request(conn, true);
+        close_conn(server, conn);
+        return;
+    }
+    push_conn(&server->hub->joining, conn);
+    send(server->hub->wake_pair[1], "", 1, 0);
+}
+
+/// Send as much of the response as the socket accepts, header and body with a single call.
+/// Rest of a streamed response or of a live stream event is sent the same way, with empty header.
+void write_response(Server *server, Connection *conn)
+{
+    conn->last_active = get_secs();
+    while (conn->response_sent < conn->header_len + conn->body_len) {
+        SendBuffer buffers[2] = {{conn->header, conn->header_len}, {conn->body, conn->body_len}};
+        usize first = skip_sent_buffers(buffers, 2, conn->response_sent);
+        i64 n = send_buffers(conn->socket, buffers + first, 2 - first);
+        if (n == -1 && is_socket_would_block()) {
+            if (watch_conn(server, conn, POLL_WRITE) == -1)
+                close_conn(server, conn);
+            return;
+        }
+        if (n == -1) {
+            write_access_log(access_log, ACCESS_LOG_INFO, "msg=\"Failed to respond to client\" error=\"%s\"",
+                             strerror(errno));
+            log_request(conn, !conn->is_subscribed); // Live stream ends with the client leaving
+            close_conn(server, conn);
+            return;
+        }
+        conn->response_sent += n;
+    }
+
+    if (conn->stream != NULL)
+        continue_stream_in_worker(server, conn);
+    else if (conn->is_subscribed)
+        continue_stream_in_hub(server, conn);
+    else
+        finish_response(server, conn);
+}
+
+/// Receive available part of the request, pass it to workers once it is complete.
+void read_request(Server *server, Connection *conn)
+{
+    conn->last_active = get_secs();
+
+    i64 n = recv(conn->socket, conn->request + conn->request_len, HTTP_GET_MAX_LEN - conn->request_len, 0);
+    if (n == -1 && is_socket_would_block())
+        return;
+    if (n <= 0) { // Error or client closed the connection
+        if (n == -1)
+            write_access_log(access_log, ACCESS_LOG_INFO, "msg=\"Failed reading from client\" error=\"%s\"",
+                             strerror(errno));
+        close_conn(server, conn);
+        return;
+    }
+
+    if (conn->request_len == 0)
+        conn->request_start = conn->last_active;
+    conn->request_len += n;
+    conn->request[conn->request_len] = '\0';
+    dispatch_request(server, conn);
+}
+
+/// Close connections which don't finish sending the request within header timeout, and the ones waiting
+/// for the next request, for the response to be read or for client to close longer than idle timeout.
+void close_idle_conns(Server *server, f64 now)
+{
+    // Closing moves the last connection in place of the closed one, so iterate from the end.
+    for (usize i = server->n_conns; i > 0; i--) {
+        Connection *conn = server->conns[i - 1];
+        bool is_receiving = conn->state == CONN_READING && conn->request_len > 0;
+        bool is_waiting =
+            conn->state == CONN_READING || conn->state == CONN_WRITING || conn->state == CONN_CLOSING;
+        if (is_receiving && now - conn->request_start > limits.header_timeout_secs) {
+            write_access_log(access_log, ACCESS_LOG_INFO, "msg=\"Client didn't send whole request in time\"");
+            close_conn(server, conn);
+        } else if (!is_receiving && is_waiting && now - conn->last_active > limits.idle_timeout_secs) {
+            if (conn->state == CONN_WRITING) {
+                write_access_log(access_log, ACCESS_LOG_INFO, "msg=\"Client stopped reading response\"");
+                log_request(conn, true);
+            }
+            close_conn(server, conn);
+        }
+    }
+}
+
+/// Accept all the pending clients.
+void accept_clients(Server *server)
+{
+    while (true) {
+        SocketAddress addr;
+        Socket client = accept_socket(server->listen_socket, &addr);
+        if (client == (Socket)-1) {
+            if (!is_socket_would_block())
+                write_access_log(access_log, ACCESS_LOG_ERROR, "msg=\"Failed to accept client\" error=\"%s\"",
+                                 strerror(errno));
+            return;
+        }
+
+        if (server->n_conns == limits.max_connections || set_socket_nonblocking(client) == -1) {
+            write_access_log(access_log, ACCESS_LOG_ERROR, "msg=\"Too many connections, rejecting client\"");
+            char response[RESPONSE_HEADER_MAX_LEN];
+            usize len = print_error_response(response, "503", "Service Unavailable", false);
+            send_buffers(client, &(SendBuffer){response, len}, 1);
+            close_socket(client);
+            continue;
+        }
+
+        Connection *conn = xmalloc(sizeof(Connection));
+        *conn = (Connection){.socket = client,
+                             .state = CONN_READING,
+                             .slot = server->n_conns,
+                             .last_active = get_secs(),
+                             .client_addr = addr.sin_addr.s_addr};
+        init_http_request(&conn->http);
+        server->conns[server->n_conns++] = conn;
+        add_gauge(&metrics.connections, 1);
+
+        if (watch_conn(server, conn, POLL_READ) == -1)
+            close_conn(server, conn);
+    }
+}
+
+/// Start sending responses of all the requests processed by workers.
+void handle_responses(Server *server)
+{
+    char buf[64];
+    while (recv(server->wake_pair[0], buf, sizeof(buf), 0) > 0)
+        ;
+
+    Connection *conn;
+    while ((conn = pop_conn(&server->responses, false)) != NULL) {
+        if (conn->is_broken || conn->is_unsubscribed) {
+            log_request(conn, conn->is_broken);
+            close_conn(server, conn);
+            continue;
+        }
+        conn->state = CONN_WRITING;
+        write_response(server, conn);
+    }
+}
+
+void handle_conn_event(Server *server, Connection *conn, u32 events)
+{
+    if (conn->state == CONN_READING && (events & (POLL_READ | POLL_ERROR)))
+        read_request(server, conn);
+    else if (conn->state == CONN_WRITING && (events & (POLL_WRITE | POLL_ERROR)))
+        write_response(server, conn);
+    else if (conn->state == CONN_CLOSING && (events & (POLL_READ | POLL_ERROR)))
+        read_closing(server, conn);
+}
+
+/// Open listening socket, wake up pair and poller.
+/// Exit with code 1 on failure.
+void init_server(Server *server)
+{
+    server->n_conns = 0;
+    init_conn_queue(&server->requests);
+    init_conn_queue(&server->responses);
+    server->cache = create_response_cache(RESPONSE_CACHE_MAX_ENTRIES, RESPONSE_CACHE_MAX_BYTES);
+    server->limiter = create_rate_limiter(limits.client_rate, limits.client_burst, RATE_LIMIT_MAX_CLIENTS);
+
+    server->listen_socket = open_socket_tcp();
+    if (server->listen_socket == (Socket)-1) {
         perror("Failed to open socket");
         exit(1);
     }
 
     SocketAddress server_addr = init_ipv4_addr(LISTEN_PORT);
 
-    int res = bind(server_socket, (const struct sockaddr *)&server_addr, sizeof(server_addr));
+    int res = bind(server->listen_socket, (const struct sockaddr *)&server_addr, sizeof(server_addr));
     if (res == -1) {
         perror("Failed to bind socket");
         exit(1);
     }
 
-    res = listen(server_socket, MAX_PENDING);
+    res = listen(server->listen_socket, MAX_PENDING);
     if (res == -1) {
         perror("Failed to listen on socket");
         exit(1);
     }
 
-    fprintf(stderr, "Server successfully started!\n");
+    if (open_socket_pair(server->wake_pair) == -1) {
+        perror("Failed to open wake up socket pair");
+        exit(1);
+    }
+
+    server->poller = open_poller();
+    if (server->poller == NULL) {
+        perror("Failed to open poller");
+        exit(1);
+    }
+
+    // Listening and wake up sockets are told apart from connections by their data pointers.
+    if (set_socket_nonblocking(server->listen_socket) == -1 ||
+        set_socket_nonblocking(server->wake_pair[0]) == -1 ||
+        set_socket_nonblocking(server->wake_pair[1]) == -1 ||
+        add_poll_socket(server->poller, server->listen_socket, POLL_READ, &server->listen_socket) == -1 ||
+        add_poll_socket(server->poller, server->wake_pair[0], POLL_READ, &server->wake_pair[0]) == -1) {
+        perror("Failed to set up server sockets");
+        exit(1);
+    }
+}
+
+/// Close all the sockets, workers have to be joined already.
+void deinit_server(Server *server)
+{
+    while (server->n_conns > 0)
+        close_conn(server, server->conns[0]);
+
+    if (close_poller(server->poller) == -1)
+        fprintf(stderr, "Failed to close poller!\n");
+    if (close_socket(server->listen_socket) == -1)
+        fprintf(stderr, "Failed to close socket!\n");
+    close_socket(server->wake_pair[0]);
+    close_socket(server->wake_pair[1]);
+
+    deinit_conn_queue(&server->requests);
+    deinit_conn_queue(&server->responses);
+    destroy_response_cache(server->cache);
+    destroy_rate_limiter(server->limiter);
+}
 
+/// Create tables, if the logger hasn't done it yet, so that workers can open storage read-only.
+void init_storage(const char *db_path)
+{
+    LogStorage *storage = open_log_storage(db_path);
+    int res = 0;
+    for (int i = 0; i < 3; i++)
+        res |= deinit_log(init_log(storage, LOG_ARGS[i]));
+    res |= close_log_storage(storage);
+    if (res != 0) {
+        fprintf(stderr, "Failed to initialize logs in %s!\n", db_path);
+        exit(1);
+    }
+}
+
+/// Parse command line option like "--max-queued=100" into limits.
+/// Return 0 on success, -1 if the option is unknown or its value is invalid.
+int parse_limit_option(const char *arg)
+{
+    const char *value = strchr(arg, '=');
+    if (value == NULL)
+        return -1;
+    usize name_len = value++ - arg;
+
+    bool is_valid;
+#define IS_OPTION(NAME) (name_len == strlen(NAME) && strncmp(arg, NAME, name_len) == 0)
+    if (IS_OPTION("--max-connections"))
+        is_valid = sscanf(value, "%zu", &limits.max_connections) == 1 && limits.max_connections > 0 &&
+                   limits.max_connections <= MAX_CONNECTIONS;
+    else if (IS_OPTION("--max-queued"))
+        is_valid = sscanf(value, "%zu", &limits.max_queued) == 1 && limits.max_queued > 0;
+    else if (IS_OPTION("--idle-timeout"))
+        is_valid = sscanf(value, "%u", &limits.idle_timeout_secs) == 1 && limits.idle_timeout_secs > 0;
+    else if (IS_OPTION("--header-timeout"))
+        is_valid = sscanf(value, "%u", &limits.header_timeout_secs) == 1 && limits.header_timeout_secs > 0;
+    else if (IS_OPTION("--client-rate"))
+        is_valid = sscanf(value, "%lf", &limits.client_rate) == 1 && limits.client_rate >= 0;
+    else if (IS_OPTION("--client-burst"))
+        is_valid = sscanf(value, "%lf", &limits.client_burst) == 1 && limits.client_burst >= 1;
+    else
+        is_valid = false;
+#undef IS_OPTION
+    return is_valid ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+#ifndef USEDB
+    fprintf(stderr, "HTTP server without database is not supported.\n");
+    exit(2);
+#endif
+    int first_arg = 1;
+    for (; first_arg < argc && strncmp(argv[first_arg], "--", 2) == 0; first_arg++) {
+        if (parse_limit_option(argv[first_arg]) == -1) {
+            fprintf(stderr, "Invalid option: %s\n", argv[first_arg]);
+            exit(2);
+        }
+    }
+    int n_args = argc - first_arg;
+    if (n_args < 1 || n_args > 3) {
+        fprintf(stderr, "Usage: temp_server [OPTION=VALUE...] LOG_PATH [N_WORKERS [error|info|debug]]\n"
+                        "Options: --max-connections=N --max-queued=N\n"
+                        "         --idle-timeout=SECS --header-timeout=SECS\n"
+                        "         --client-rate=REQUESTS_PER_SEC (0 disables) --client-burst=REQUESTS\n");
+        exit(2);
+    }
+    snprintf(connection_keep_alive, sizeof(connection_keep_alive), CONNECTION_KEEP_ALIVE_FSTRING,
+             limits.idle_timeout_secs, KEEP_ALIVE_MAX_REQUESTS);
+
+    usize n_workers = get_cpu_count();
+    if (n_workers > MAX_WORKERS)
+        n_workers = MAX_WORKERS;
+    if (n_args >= 2) {
+        const char *arg = argv[first_arg + 1];
+        if (sscanf(arg, "%zu", &n_workers) != 1 || n_workers == 0 || n_workers > MAX_WORKERS) {
+            fprintf(stderr, "Invalid number of workers, expected 1 to %d: %s\n", MAX_WORKERS, arg);
+            exit(2);
+        }
+    }
+
+    const char *level_name = n_args == 3 ? argv[first_arg + 2] : DEFAULT_ACCESS_LOG_LEVEL;
+    AccessLogLevel level;
+    if (parse_access_log_level(level_name, &level) == -1) {
+        fprintf(stderr, "Unknown access log level: %s\n", level_name);
+        exit(2);
+    }
+    access_log = start_access_log(stderr, level, ACCESS_LOG_BUFFER_SIZE);
+
+#ifndef WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    signal(SIGINT, sigint_handler);
+
+    char *db_path = argv[first_arg];
+    init_storage(db_path);
+
+    // Server is big because of the connections table, so it is not placed on the stack.
+    Server *server = xmalloc(sizeof(Server));
+    init_server(server);
+
+    Worker workers[MAX_WORKERS];
+    for (usize i = 0; i < n_workers; i++) {
+        workers[i].db_path = db_path;
+        workers[i].server = server;
+        usize err = start_thread(&workers[i].thread, worker_main, &workers[i]);
+        if (err != 0) {
+            fprintf(stderr, "Failed to start worker thread: %s (%zu)\n", strerror(err), err);
+            exit(1);
+        }
+    }
+
+    server->hub = start_stream_hub(server, db_path);
+
+    fprintf(stderr, "Server successfully started with %zu workers!\n", n_workers);
+
+    PollEvent events[MAX_POLL_EVENTS];
+    f64 last_idle_check = get_secs();
     while (is_working) {
-        // TODO: this it kind of legacy, but all the other solutions are platform-specific,
-        // so this will do for now.
-        // poll for POSIX, IOCP for Windows are better choices.
-        // Also possibly epoll for Linux and kqueue for OS X/FreeBSD.
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(server_socket, &read_fds);
-        struct timeval accept_timeout = {
-            .tv_sec = 0,
-            .tv_usec = ACCEPT_TIMEOUT_MS * 1000,
-        };
-        int n_ready = select(server_socket + 1, &read_fds, NULL, NULL, &accept_timeout);
-        if (n_ready == -1) {
-            if (errno == EINTR)
-                break;
-            perror("Failed to call select() with server socket");
+        int n_events = wait_poller(server->poller, events, MAX_POLL_EVENTS, POLL_TIMEOUT_MS);
+        if (n_events == -1) {
+            if (errno != EINTR)
+                perror("Failed to wait for sockets");
             continue;
         }
-        if (n_ready == 0) // Timed out
-            continue;
 
-        Socket client_socket = accept(server_socket, NULL, NULL);
-        if (client_socket == (Socket)-1) {
-            perror("Failed to accept client");
-            continue;
+        for (int i = 0; i < n_events; i++) {
+            if (events[i].data == &server->listen_socket)
+                accept_clients(server);
+            else if (events[i].data == &server->wake_pair[0])
+                handle_responses(server);
+            else
+                handle_conn_event(server, events[i].data, events[i].events);
         }
 
-        handle_client(logs, client_socket);
+        f64 now = get_secs();
+        if (now - last_idle_check >= IDLE_CHECK_PERIOD_SECS) {
+            close_idle_conns(server, now);
+            last_idle_check = now;
+        }
     }
 
-    if (close_socket(server_socket) == -1)
-        fprintf(stderr, "Failed to close socket!\n");
+    // Workers finish the requests left in the queue before exiting, their responses are not sent.
+    close_conn_queue(&server->requests);
+    for (usize i = 0; i < n_workers; i++)
+        join_thread(workers[i].thread);
+    stop_stream_hub(server->hub);
 
-    res = 0;
-    for (int i = 0; i < 3; i++)
-        res |= deinit_log(logs[i]);
-
-    if (res != 0)
-        fprintf(stderr, "Failed to deinit logs!\n");
+    deinit_server(server);
+    free(server);
+    stop_access_log(access_log);
 
     fprintf(stderr, "Server finished!\n");
 }
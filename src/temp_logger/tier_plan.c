@@ -0,0 +1,231 @@
+/// Planning of range queries over the logs of different resolution and merging them into one series.
+/// Every log is sorted by time, a coarser log keeps older entries than a finer one and a finer log
+/// has newer entries than a coarser one, so the series is read from the coarsest log to the finest one
+/// without sorting.
+
+#include "tier_plan.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger_interface.h"
+#include "my_types.h"
+#include "temp_logger.h"
+#include "utils.h"
+
+#define ARRAY_INIT_CAPACITY 64
+
+// Seconds between entries and seconds entries are kept for, of every log
+static const f64 TIER_PERIODS[3] = {SAMPLE_PERIOD_LOG1, PERIOD_LOG2, PERIOD_LOG3};
+static const f64 TIER_KEEP_PERIODS[3] = {MAX_KEEP_LOG1, MAX_KEEP_LOG2, MAX_KEEP_LOG3};
+
+struct TierCursor {
+    TierPlan plan;
+    Log **logs;
+    i64 start_ms;
+    i64 end_ms;
+
+    TierPosition after; // Position to resume after, the log of it is opened right after the entry
+
+    // Logs finer than the preferred one are opened once it's read, from its last entry
+    LogCursor *cursors[3]; // NULL for logs out of the plan or not opened yet
+    TempEntry next[3];     // Entry to be returned next, read ahead to find where finer logs start
+    i64 next_ids[3];       // Row ids of the next entries
+    bool has_next[3];
+    i64 cutoffs[3];    // Entries of the log at or after the cutoff are covered by finer logs
+    TierPosition last; // Position of the last returned entry, or the one resumed after
+    int tier;          // Log being read, from the coarsest to the finest
+};
+
+static int open_tier(TierCursor *cursor, int tier);
+static int read_ahead(TierCursor *cursor, int tier);
+
+TierPlan plan_tiers(i64 start_ms, i64 end_ms, i64 now_ms, usize max_points, int tier)
+{
+    if (tier > 0)
+        return (TierPlan){.finest = tier - 1, .preferred = tier - 1, .coarsest = tier - 1};
+    if (max_points == 0)
+        return (TierPlan){.finest = 0, .preferred = 0, .coarsest = 2};
+
+    if (start_ms == INT64_MIN)
+        start_ms = now_ms - (i64)(TIER_KEEP_PERIODS[2] * 1000);
+    if (end_ms == INT64_MAX || end_ms > now_ms)
+        end_ms = now_ms;
+    f64 span_secs = end_ms > start_ms ? (f64)(end_ms - start_ms) / 1000 : 0;
+
+    int preferred = 0;
+    for (int i = 2; i > 0; i--) {
+        if (span_secs / TIER_PERIODS[i] >= (f64)max_points) {
+            preferred = i;
+            break;
+        }
+    }
+    return (TierPlan){.finest = 0, .preferred = preferred, .coarsest = 2};
+}
+
+TierCursor *open_tier_cursor(Log **logs, const TierPlan *plan, i64 start_ms, i64 end_ms,
+                             const TierPosition *after)
+{
+    assert(after->tier == -1 || (after->tier >= plan->finest && after->tier <= plan->coarsest));
+
+    TierCursor *cursor = xmalloc(sizeof(TierCursor));
+    memset(cursor, 0, sizeof(TierCursor));
+    cursor->plan = *plan;
+    cursor->logs = logs;
+    cursor->start_ms = start_ms;
+    cursor->end_ms = end_ms;
+    cursor->after = *after;
+    cursor->last = (TierPosition){.tier = -1, .ts_ms = INT64_MIN, .id = 0};
+    cursor->tier = plan->coarsest;
+
+    // Coarser logs than the one of the position are read already. Finer ones are opened from the start
+    // all the same, as their first entries tell where the coarser ones are cut off.
+    if (after->tier != -1) {
+        cursor->last = *after;
+        cursor->tier = after->tier;
+    }
+
+    for (int i = plan->preferred; i <= cursor->tier; i++) {
+        if (open_tier(cursor, i) == -1) {
+            close_tier_cursor(cursor);
+            return NULL;
+        }
+
+        cursor->cutoffs[i] = INT64_MAX;
+        if (i > plan->preferred) {
+            cursor->cutoffs[i] = cursor->cutoffs[i - 1];
+            if (cursor->has_next[i - 1] && cursor->next[i - 1].ts_ms < cursor->cutoffs[i])
+                cursor->cutoffs[i] = cursor->next[i - 1].ts_ms;
+        }
+    }
+    return cursor;
+}
+
+int next_tier_entry(TierCursor *cursor, TempEntry *entry)
+{
+    while (cursor->tier >= cursor->plan.finest) {
+        int i = cursor->tier;
+        if (cursor->cursors[i] == NULL) {
+            cursor->cutoffs[i] = INT64_MAX;
+            if (open_tier(cursor, i) == -1)
+                return -1;
+        }
+
+        // Finer logs may still have entries the previous one has covered, entries of the same time
+        // in one log are all returned
+        while (i != cursor->last.tier && cursor->has_next[i] && cursor->next[i].ts_ms <= cursor->last.ts_ms) {
+            if (read_ahead(cursor, i) == -1)
+                return -1;
+        }
+
+        if (cursor->has_next[i] && cursor->next[i].ts_ms < cursor->cutoffs[i]) {
+            *entry = cursor->next[i];
+            cursor->last = (TierPosition){.tier = i, .ts_ms = entry->ts_ms, .id = cursor->next_ids[i]};
+            return read_ahead(cursor, i) == -1 ? -1 : 1;
+        }
+        cursor->tier--;
+    }
+    return 0;
+}
+
+void get_tier_position(const TierCursor *cursor, TierPosition *position)
+{
+    *position = cursor->last;
+}
+
+void close_tier_cursor(TierCursor *cursor)
+{
+    for (int i = 0; i < 3; i++) {
+        if (cursor->cursors[i] != NULL)
+            close_log_cursor(cursor->cursors[i]);
+    }
+    free(cursor);
+}
+
+TempArray *get_tier_entries(Log **logs, const TierPlan *plan, i64 start_ms, i64 end_ms,
+                            const TierPosition *after, usize max_entries, TierPosition *next)
+{
+    TierCursor *cursor = open_tier_cursor(logs, plan, start_ms, end_ms, after);
+    if (cursor == NULL)
+        return NULL;
+
+    TempArray *array = xmalloc(sizeof(TempArray));
+    array->items = NULL;
+    array->size = 0;
+    usize capacity = 0;
+
+    TempEntry entry;
+    int res = 0;
+    while (array->size < max_entries && (res = next_tier_entry(cursor, &entry)) == 1) {
+        if (array->size == capacity) {
+            usize new_capacity = capacity == 0 ? ARRAY_INIT_CAPACITY : capacity * 2;
+            TempEntry *items = realloc(array->items, sizeof(TempEntry) * new_capacity);
+            if (items == NULL) {
+                fprintf(stderr, "Failed to allocate memory for TempArray of size %zu: %s (%d)\n",
+                        new_capacity, strerror(errno), errno);
+                res = -1;
+                break;
+            }
+            array->items = items;
+            capacity = new_capacity;
+        }
+        array->items[array->size++] = entry;
+    }
+
+    // One more entry tells whether the series continues
+    next->tier = -1;
+    if (res != -1 && array->size == max_entries && array->size > 0) {
+        TierPosition position;
+        get_tier_position(cursor, &position);
+        res = next_tier_entry(cursor, &entry);
+        if (res == 1)
+            *next = position;
+    }
+    close_tier_cursor(cursor);
+
+    if (res == -1) {
+        free(array->items);
+        free(array);
+        return NULL;
+    }
+    return array;
+}
+
+/// Open cursor of the log and read its first entry. Logs finer than the preferred one are read
+/// only from the last returned entry on, so that they don't go through the range covered already,
+/// and the log of the resumed position right after it.
+/// Return 0 on success, -1 on error.
+static int open_tier(TierCursor *cursor, int tier)
+{
+    const TierPosition *after = &cursor->after;
+    if (tier == after->tier && after->ts_ms >= cursor->start_ms) {
+        cursor->cursors[tier] =
+            open_log_cursor_after(cursor->logs[tier], after->ts_ms, after->id, cursor->end_ms);
+    } else {
+        i64 start_ms = cursor->start_ms;
+        if (tier < cursor->plan.preferred && cursor->last.tier != -1)
+            start_ms = cursor->last.ts_ms + 1;
+        cursor->cursors[tier] = open_log_cursor(cursor->logs[tier], start_ms, cursor->end_ms);
+    }
+    if (cursor->cursors[tier] == NULL)
+        return -1;
+    return read_ahead(cursor, tier);
+}
+
+/// Read the next non-null entry of the log into cursor->next.
+/// Return 0 on success, -1 on error.
+static int read_ahead(TierCursor *cursor, int tier)
+{
+    int res;
+    do {
+        res = next_log_entry(cursor->cursors[tier], &cursor->next[tier]);
+    } while (res == 1 && memcmp(&cursor->next[tier], &(TempEntry){0}, sizeof(TempEntry)) == 0);
+
+    if (res == 1)
+        cursor->next_ids[tier] = get_log_cursor_id(cursor->cursors[tier]);
+    cursor->has_next[tier] = res == 1;
+    return res == -1 ? -1 : 0;
+}
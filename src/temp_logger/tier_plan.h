@@ -0,0 +1,60 @@
+#pragma once
+
+#include "logger_interface.h"
+#include "my_types.h"
+
+/// Logs of a range query, by index in LOG_ARGS. Log 1 holds raw samples, logs 2 and 3 hold averages
+/// of ever longer periods and are kept longer. The preferred log gives the resolution of the series,
+/// coarser logs fill in the part of the range before it starts, and finer logs the part after it ends,
+/// as averages are written only once their period is over.
+typedef struct {
+    int finest;    // Index of the finest log read
+    int preferred; // Index of the log of the resolution wanted
+    int coarsest;  // Index of the coarsest log read, all are equal if only one log is read
+} TierPlan;
+
+/// Position of an entry in the merged series, to resume reading right after it.
+/// Entries of the same time in a log are told apart by their row ids.
+typedef struct {
+    int tier; // Index of the log the entry is read from, -1 for no entry
+    i64 ts_ms;
+    i64 id;
+} TierPosition;
+
+struct TierCursor;
+typedef struct TierCursor TierCursor;
+
+/// Plan logs to read for range of Unix milliseconds, unbounded ends (INT64_MIN, INT64_MAX) are clamped
+/// to what the logs keep as of now_ms.
+/// tier is 1-based log number to read only that log, or 0 to prefer the coarsest log having at least
+/// max_points entries over the range, or the finest log if max_points is 0.
+TierPlan plan_tiers(i64 start_ms, i64 end_ms, i64 now_ms, usize max_points, int tier);
+
+/// Open cursor reading entries of the planned logs within range of Unix milliseconds [start_ms, end_ms],
+/// INT64_MIN and INT64_MAX for unbounded ends, as a single series in time order.
+/// Entries of a coarser log at or after the first entry of a finer one are skipped, and so are entries
+/// of a finer log at or before the last entry of the preferred one, and null entries.
+/// The series is read from the start if after->tier is -1, otherwise right after the position, which
+/// has to come from a cursor of the same plan and range.
+/// Caller is responsible for closing it with close_tier_cursor.
+/// Return pointer to cursor or NULL on error.
+TierCursor *open_tier_cursor(Log **logs, const TierPlan *plan, i64 start_ms, i64 end_ms,
+                             const TierPosition *after);
+
+/// Read the next entry of the merged series.
+/// Return 1 if entry is read, 0 if there are no more entries, -1 on error.
+int next_tier_entry(TierCursor *cursor, TempEntry *entry);
+
+/// Get position of the entry read last, tier is -1 if none is read yet.
+void get_tier_position(const TierCursor *cursor, TierPosition *position);
+
+void close_tier_cursor(TierCursor *cursor);
+
+/// Get at most max_entries entries of the merged series, as open_tier_cursor reads them,
+/// SIZE_MAX for all of them.
+/// next is set to the position of the last entry got if the series continues after it, its tier to -1
+/// otherwise.
+/// Caller is responsible for memory freeing.
+/// Return pointer to allocated TempArray or NULL on error.
+TempArray *get_tier_entries(Log **logs, const TierPlan *plan, i64 start_ms, i64 end_ms,
+                            const TierPosition *after, usize max_entries, TierPosition *next);
@@ -1,3 +1,5 @@
+#pragma once
+
 #ifdef WIN32
 #include <winsock2.h>
 #include <windows.h>
@@ -16,14 +18,92 @@ Socket open_socket_tcp();
 
 int close_socket(Socket socket);
 
+/// Stop sending data on socket, the other side receives end of stream once sent data is delivered.
+/// Return 0 on success, -1 on error.
+int shutdown_socket_send(Socket socket);
+
 // int bind_socket(Socket socket, SocketAddress *address);
 //
 // int listen_socket(Socket socket, int max_pending);
-//
-// Socket accept_socket(Socket socket);
+
+/// Accept pending connection of listening IPv4 socket, address is set to the address of the client.
+/// Return socket of the connection, or (Socket)-1 on error.
+Socket accept_socket(Socket socket, SocketAddress *address);
 
 SocketAddress init_ipv4_addr(u16 port);
 
+/// Switch socket to non-blocking mode.
+/// Return 0 on success, -1 on error.
+int set_socket_nonblocking(Socket socket);
+
+/// Check if the last failed socket call on non-blocking socket would have blocked, so it's to be retried
+/// once the socket is ready.
+bool is_socket_would_block(void);
+
+#define SOCKET_MAX_SEND_BUFFERS 16
+
+/// Part of data sent by send_buffers.
+typedef struct {
+    const void *data;
+    usize len;
+} SendBuffer;
+
+/// Send buffers one after another with a single call, without raising SIGPIPE if the peer has closed
+/// the connection. Non-blocking socket may accept only a part of the data.
+/// n_buffers is at most SOCKET_MAX_SEND_BUFFERS.
+/// Return number of bytes sent, -1 on error.
+i64 send_buffers(Socket socket, const SendBuffer *buffers, usize n_buffers);
+
+/// Wait until non-blocking socket has data to read or timeout in milliseconds expires.
+/// Return 1 if socket is ready (or failed, which the next recv reports), 0 on timeout, -1 on error.
+int wait_socket_readable(Socket socket, i32 timeout_ms);
+
+/// Open a pair of connected sockets, writing to one of them makes the other readable.
+/// Used to wake up a thread waiting in wait_poller from other threads.
+/// Return 0 on success, -1 on error.
+int open_socket_pair(Socket pair[2]);
+
+/// Readiness notification for many sockets at once: epoll on Linux, poll on other POSIX systems
+/// and WSAPoll on Windows.
+struct Poller;
+typedef struct Poller Poller;
+
+typedef enum {
+    POLL_READ = 1 << 0,  // Socket has data to read or connection to accept
+    POLL_WRITE = 1 << 1, // Socket can be written to
+    POLL_ERROR = 1 << 2, // Error or hang up, reported even if not requested
+} PollFlags;
+
+typedef struct {
+    void *data; // Pointer provided when socket was added
+    u32 events; // Set of PollFlags
+} PollEvent;
+
+/// Open new poller without any sockets.
+/// Return NULL on error.
+Poller *open_poller(void);
+
+/// Close poller, sockets in it are not closed.
+/// Return 0 on success, -1 on error.
+int close_poller(Poller *poller);
+
+/// Start watching socket for events, a set of PollFlags. data is returned with every event of the socket.
+/// Return 0 on success, -1 on error.
+int add_poll_socket(Poller *poller, Socket socket, u32 events, void *data);
+
+/// Change watched events and data of a socket added to poller.
+/// Return 0 on success, -1 on error.
+int modify_poll_socket(Poller *poller, Socket socket, u32 events, void *data);
+
+/// Stop watching socket, it has to be done before closing the socket.
+/// Return 0 on success, -1 on error.
+int remove_poll_socket(Poller *poller, Socket socket);
+
+/// Wait until some of the sockets are ready or timeout in milliseconds expires, -1 to wait without limit.
+/// Sockets stay watched (level-triggered), so the event repeats until it is handled.
+/// Return number of events written to events, 0 on timeout, -1 on error.
+int wait_poller(Poller *poller, PollEvent *events, usize max_events, i32 timeout_ms);
+
 #ifdef CROSS_SOCKET_IMPL
 SocketAddress init_ipv4_addr(u16 port)
 {
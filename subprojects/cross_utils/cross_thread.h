@@ -0,0 +1,46 @@
+#pragma once
+
+#ifdef WIN32
+#include <windows.h>
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE CondVar;
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+#endif
+
+#include "my_types.h"
+
+typedef void *(*ThreadFunc)(void *arg);
+
+/// Start executing func(arg) in a new thread.
+/// Return 0 if successful, otherwise errno on Linux, GetLastError on Windows.
+usize start_thread(Thread *thread, ThreadFunc func, void *arg);
+
+/// Wait for thread to finish and release its resources.
+/// Return 0 if successful, otherwise errno on Linux, GetLastError on Windows.
+usize join_thread(Thread thread);
+
+/// Return number of online processors, at least 1.
+usize get_cpu_count(void);
+
+void init_mutex(Mutex *mutex);
+void destroy_mutex(Mutex *mutex);
+void lock_mutex(Mutex *mutex);
+void unlock_mutex(Mutex *mutex);
+
+void init_cond(CondVar *cond);
+void destroy_cond(CondVar *cond);
+
+/// Atomically unlock mutex and wait for cond to be signaled, mutex is locked again on return.
+/// Spurious wakeups are possible, so the waited condition has to be checked in a loop.
+void wait_cond(CondVar *cond, Mutex *mutex);
+
+/// Wake up one thread waiting for cond.
+void signal_cond(CondVar *cond);
+
+/// Wake up all the threads waiting for cond.
+void broadcast_cond(CondVar *cond);
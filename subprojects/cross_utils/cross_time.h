@@ -26,6 +26,7 @@ f64 get_secs(void);
 void get_datetime_from_tm(DateTime *date, struct tm *tm);
 
 /// Fill provided datetime object from seconds since the Epoch, 1970-01-01 00:00:00 +0000 (UTC).
+/// Thread-safe.
 /// Exit on fail.
 void get_datetime_from_secs(DateTime *date, f64 secs);
 
@@ -69,14 +70,20 @@ void get_datetime_from_tm(DateTime *date, struct tm *tm)
 
 void get_datetime_from_secs(DateTime *date, f64 secs)
 {
-    i64 t = (i64)secs;
-    struct tm *tp = localtime(&t);
-    if (tp == NULL) {
+    // Reentrant versions, as localtime returns a buffer shared by all the threads
+    time_t t = (time_t)secs;
+    struct tm tm;
+#ifdef WIN32
+    bool is_failed = localtime_s(&tm, &t) != 0;
+#else
+    bool is_failed = localtime_r(&t, &tm) == NULL;
+#endif
+    if (is_failed) {
         perror("Failed to get system localtime! Exiting...");
         exit(1);
     }
 
-    get_datetime_from_tm(date, tp);
+    get_datetime_from_tm(date, &tm);
     date->secs += modf(secs, &(double){0});
 }
 
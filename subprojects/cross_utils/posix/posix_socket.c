@@ -2,11 +2,43 @@
 #include "cross_socket.h"
 #undef CROSS_SOCKET_IMPL
 
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #include "my_types.h"
+#include "utils.h"
+
+#ifdef __linux__
+struct Poller {
+    int epoll_fd;
+    struct epoll_event *events; // Buffer for epoll_wait, grown to max_events
+    usize capacity;
+};
+
+static u32 to_epoll_events(u32 events);
+#else
+/// Fallback for systems without epoll: sockets are kept in an array and passed to poll() as a whole.
+struct Poller {
+    struct pollfd *fds;
+    void **data;
+    usize size;
+    usize capacity;
+};
+
+static short to_poll_events(u32 events);
+static i64 find_poll_socket(Poller *poller, Socket socket);
+#endif
 
 Socket open_socket_tcp()
 {
@@ -38,3 +70,216 @@ int close_socket(Socket socket)
 //     return accept(socket, NULL, NULL);
 // }
     
+
+int shutdown_socket_send(Socket socket)
+{
+    return shutdown(socket, SHUT_WR);
+}
+
+Socket accept_socket(Socket socket, SocketAddress *address)
+{
+    socklen_t len = sizeof(SocketAddress);
+    return accept(socket, (struct sockaddr *)address, &len);
+}
+
+int set_socket_nonblocking(Socket socket)
+{
+    int flags = fcntl(socket, F_GETFL);
+    if (flags == -1)
+        return -1;
+    return fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+}
+
+bool is_socket_would_block(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+i64 send_buffers(Socket socket, const SendBuffer *buffers, usize n_buffers)
+{
+    assert(n_buffers <= SOCKET_MAX_SEND_BUFFERS);
+    struct iovec iov[SOCKET_MAX_SEND_BUFFERS];
+    for (usize i = 0; i < n_buffers; i++) {
+        iov[i].iov_base = (void *)buffers[i].data;
+        iov[i].iov_len = buffers[i].len;
+    }
+
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = n_buffers};
+#ifdef MSG_NOSIGNAL
+    return sendmsg(socket, &msg, MSG_NOSIGNAL);
+#else
+    return sendmsg(socket, &msg, 0); // SIGPIPE has to be ignored by the process
+#endif
+}
+
+int wait_socket_readable(Socket socket, i32 timeout_ms)
+{
+    struct pollfd fd = {.fd = socket, .events = POLLIN};
+    int n = poll(&fd, 1, timeout_ms);
+    if (n == -1 && errno == EINTR) // Caller retries recv and waits again if it still would block
+        return 1;
+    return n;
+}
+
+int open_socket_pair(Socket pair[2])
+{
+    return socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+}
+
+#ifdef __linux__
+Poller *open_poller(void)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+        return NULL;
+
+    Poller *poller = xmalloc(sizeof(Poller));
+    poller->epoll_fd = epoll_fd;
+    poller->events = NULL;
+    poller->capacity = 0;
+    return poller;
+}
+
+int close_poller(Poller *poller)
+{
+    int res = close(poller->epoll_fd);
+    free(poller->events);
+    free(poller);
+    return res;
+}
+
+int add_poll_socket(Poller *poller, Socket socket, u32 events, void *data)
+{
+    struct epoll_event event = {.events = to_epoll_events(events), .data.ptr = data};
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, socket, &event);
+}
+
+int modify_poll_socket(Poller *poller, Socket socket, u32 events, void *data)
+{
+    struct epoll_event event = {.events = to_epoll_events(events), .data.ptr = data};
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_MOD, socket, &event);
+}
+
+int remove_poll_socket(Poller *poller, Socket socket)
+{
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+}
+
+int wait_poller(Poller *poller, PollEvent *events, usize max_events, i32 timeout_ms)
+{
+    if (poller->capacity < max_events) {
+        struct epoll_event *buf = realloc(poller->events, sizeof(struct epoll_event) * max_events);
+        if (buf == NULL)
+            return -1;
+        poller->events = buf;
+        poller->capacity = max_events;
+    }
+
+    int n = epoll_wait(poller->epoll_fd, poller->events, (int)max_events, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        u32 ev = poller->events[i].events;
+        events[i].data = poller->events[i].data.ptr;
+        events[i].events = ((ev & EPOLLIN) ? POLL_READ : 0) | ((ev & EPOLLOUT) ? POLL_WRITE : 0) |
+                           ((ev & (EPOLLERR | EPOLLHUP)) ? POLL_ERROR : 0);
+    }
+    return n;
+}
+
+static u32 to_epoll_events(u32 events)
+{
+    return ((events & POLL_READ) ? EPOLLIN : 0) | ((events & POLL_WRITE) ? EPOLLOUT : 0);
+}
+#else
+Poller *open_poller(void)
+{
+    Poller *poller = xmalloc(sizeof(Poller));
+    poller->fds = NULL;
+    poller->data = NULL;
+    poller->size = 0;
+    poller->capacity = 0;
+    return poller;
+}
+
+int close_poller(Poller *poller)
+{
+    free(poller->fds);
+    free(poller->data);
+    free(poller);
+    return 0;
+}
+
+int add_poll_socket(Poller *poller, Socket socket, u32 events, void *data)
+{
+    if (poller->size == poller->capacity) {
+        usize new_capacity = poller->capacity == 0 ? 16 : poller->capacity * 2;
+        struct pollfd *fds = realloc(poller->fds, sizeof(struct pollfd) * new_capacity);
+        if (fds == NULL)
+            return -1;
+        poller->fds = fds;
+        void **new_data = realloc(poller->data, sizeof(void *) * new_capacity);
+        if (new_data == NULL)
+            return -1;
+        poller->data = new_data;
+        poller->capacity = new_capacity;
+    }
+
+    poller->fds[poller->size] = (struct pollfd){.fd = socket, .events = to_poll_events(events)};
+    poller->data[poller->size] = data;
+    poller->size++;
+    return 0;
+}
+
+int modify_poll_socket(Poller *poller, Socket socket, u32 events, void *data)
+{
+    i64 i = find_poll_socket(poller, socket);
+    if (i == -1)
+        return -1;
+    poller->fds[i].events = to_poll_events(events);
+    poller->data[i] = data;
+    return 0;
+}
+
+int remove_poll_socket(Poller *poller, Socket socket)
+{
+    i64 i = find_poll_socket(poller, socket);
+    if (i == -1)
+        return -1;
+    poller->size--;
+    poller->fds[i] = poller->fds[poller->size];
+    poller->data[i] = poller->data[poller->size];
+    return 0;
+}
+
+int wait_poller(Poller *poller, PollEvent *events, usize max_events, i32 timeout_ms)
+{
+    int n_ready = poll(poller->fds, poller->size, timeout_ms);
+    if (n_ready <= 0)
+        return n_ready;
+
+    usize n = 0;
+    for (usize i = 0; i < poller->size && n < max_events; i++) {
+        short ev = poller->fds[i].revents;
+        if (ev == 0)
+            continue;
+        events[n].data = poller->data[i];
+        events[n].events = ((ev & POLLIN) ? POLL_READ : 0) | ((ev & POLLOUT) ? POLL_WRITE : 0) |
+                           ((ev & (POLLERR | POLLHUP | POLLNVAL)) ? POLL_ERROR : 0);
+        n++;
+    }
+    return (int)n;
+}
+
+static short to_poll_events(u32 events)
+{
+    return ((events & POLL_READ) ? POLLIN : 0) | ((events & POLL_WRITE) ? POLLOUT : 0);
+}
+
+static i64 find_poll_socket(Poller *poller, Socket socket)
+{
+    for (usize i = 0; i < poller->size; i++) {
+        if (poller->fds[i].fd == socket)
+            return (i64)i;
+    }
+    return -1;
+}
+#endif
@@ -0,0 +1,67 @@
+#include "cross_thread.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "my_types.h"
+
+usize start_thread(Thread *thread, ThreadFunc func, void *arg)
+{
+    return pthread_create(thread, NULL, func, arg);
+}
+
+usize join_thread(Thread thread)
+{
+    return pthread_join(thread, NULL);
+}
+
+usize get_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (usize)n;
+}
+
+void init_mutex(Mutex *mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+void destroy_mutex(Mutex *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+void lock_mutex(Mutex *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void unlock_mutex(Mutex *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+void init_cond(CondVar *cond)
+{
+    pthread_cond_init(cond, NULL);
+}
+
+void destroy_cond(CondVar *cond)
+{
+    pthread_cond_destroy(cond);
+}
+
+void wait_cond(CondVar *cond, Mutex *mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+
+void signal_cond(CondVar *cond)
+{
+    pthread_cond_signal(cond);
+}
+
+void broadcast_cond(CondVar *cond)
+{
+    pthread_cond_broadcast(cond);
+}
@@ -1,6 +1,7 @@
 #include "utils.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -106,6 +107,17 @@ bool streql(const char *s1, const char *s2)
     return strcmp(s1, s2) == 0;
 }
 
+bool strneql_nocase(const char *s1, const char *s2, usize n)
+{
+    for (usize i = 0; i < n; i++) {
+        if (tolower((u8)s1[i]) != tolower((u8)s2[i]))
+            return false;
+        if (s1[i] == '\0')
+            return true;
+    }
+    return true;
+}
+
 void *strcat_xmalloc(const char *str1, const char *str2)
 {
     usize len = strlen(str1) + strlen(str2);
@@ -30,6 +30,9 @@ bool starts_with(const char *str, const char *prefix);
 /// Check whether s1 equals s2.
 bool streql(const char *s1, const char *s2);
 
+/// Check whether first n characters of s1 and s2 are equal, ignoring ASCII case.
+bool strneql_nocase(const char *s1, const char *s2, usize n);
+
 /// Return newly allocated memory with concatenated strings, exit on fail.
 void *strcat_xmalloc(const char *str1, const char *str2);
 
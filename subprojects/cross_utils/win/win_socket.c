@@ -2,6 +2,7 @@
 #include "cross_socket.h"
 #undef CROSS_SOCKET_IMPL
 
+#include <assert.h>
 #include <minwindef.h>
 #include <psdk_inc/_socket_types.h>
 #include <unistd.h>
@@ -9,6 +10,18 @@
 #include <winsock2.h>
 
 #include "my_types.h"
+#include "utils.h"
+
+/// Sockets are kept in an array and passed to WSAPoll as a whole.
+struct Poller {
+    WSAPOLLFD *fds;
+    void **data;
+    usize size;
+    usize capacity;
+};
+
+static short to_poll_events(u32 events);
+static i64 find_poll_socket(Poller *poller, Socket socket);
 
 Socket open_socket_tcp()
 {
@@ -32,3 +45,182 @@ int close_socket(Socket socket)
 {
     return (closesocket(socket) | WSACleanup()) ? -1 : 0;
 }
+
+int shutdown_socket_send(Socket socket)
+{
+    return shutdown(socket, SD_SEND) == 0 ? 0 : -1;
+}
+
+Socket accept_socket(Socket socket, SocketAddress *address)
+{
+    int len = sizeof(SocketAddress);
+    return accept(socket, (struct sockaddr *)address, &len);
+}
+
+int set_socket_nonblocking(Socket socket)
+{
+    u_long mode = 1;
+    return ioctlsocket(socket, FIONBIO, &mode) == 0 ? 0 : -1;
+}
+
+bool is_socket_would_block(void)
+{
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+i64 send_buffers(Socket socket, const SendBuffer *buffers, usize n_buffers)
+{
+    assert(n_buffers <= SOCKET_MAX_SEND_BUFFERS);
+    WSABUF bufs[SOCKET_MAX_SEND_BUFFERS];
+    for (usize i = 0; i < n_buffers; i++) {
+        bufs[i].buf = (char *)buffers[i].data;
+        bufs[i].len = (ULONG)buffers[i].len;
+    }
+
+    // Windows has no SIGPIPE
+    DWORD n_sent;
+    if (WSASend(socket, bufs, (DWORD)n_buffers, &n_sent, 0, NULL, NULL) == SOCKET_ERROR)
+        return -1;
+    return n_sent;
+}
+
+int wait_socket_readable(Socket socket, i32 timeout_ms)
+{
+    WSAPOLLFD fd = {.fd = socket, .events = POLLRDNORM};
+    int n = WSAPoll(&fd, 1, timeout_ms);
+    return n == SOCKET_ERROR ? -1 : n;
+}
+
+/// There is no socketpair on Windows, so connect two sockets through loopback.
+int open_socket_pair(Socket pair[2])
+{
+    Socket listener = open_socket_tcp();
+    if (listener == INVALID_SOCKET)
+        return -1;
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int addr_len = sizeof(addr);
+
+    pair[0] = pair[1] = INVALID_SOCKET;
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(listener, (struct sockaddr *)&addr, &addr_len) == SOCKET_ERROR ||
+        listen(listener, 1) == SOCKET_ERROR)
+        goto error;
+
+    pair[0] = open_socket_tcp();
+    if (pair[0] == INVALID_SOCKET || connect(pair[0], (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR)
+        goto error;
+
+    pair[1] = accept(listener, NULL, NULL);
+    if (pair[1] == INVALID_SOCKET)
+        goto error;
+
+    close_socket(listener);
+    return 0;
+error:
+    if (pair[0] != INVALID_SOCKET)
+        close_socket(pair[0]);
+    close_socket(listener);
+    return -1;
+}
+
+Poller *open_poller(void)
+{
+    Poller *poller = xmalloc(sizeof(Poller));
+    poller->fds = NULL;
+    poller->data = NULL;
+    poller->size = 0;
+    poller->capacity = 0;
+    return poller;
+}
+
+int close_poller(Poller *poller)
+{
+    free(poller->fds);
+    free(poller->data);
+    free(poller);
+    return 0;
+}
+
+int add_poll_socket(Poller *poller, Socket socket, u32 events, void *data)
+{
+    if (poller->size == poller->capacity) {
+        usize new_capacity = poller->capacity == 0 ? 16 : poller->capacity * 2;
+        WSAPOLLFD *fds = realloc(poller->fds, sizeof(WSAPOLLFD) * new_capacity);
+        if (fds == NULL)
+            return -1;
+        poller->fds = fds;
+        void **new_data = realloc(poller->data, sizeof(void *) * new_capacity);
+        if (new_data == NULL)
+            return -1;
+        poller->data = new_data;
+        poller->capacity = new_capacity;
+    }
+
+    poller->fds[poller->size] = (WSAPOLLFD){.fd = socket, .events = to_poll_events(events)};
+    poller->data[poller->size] = data;
+    poller->size++;
+    return 0;
+}
+
+int modify_poll_socket(Poller *poller, Socket socket, u32 events, void *data)
+{
+    i64 i = find_poll_socket(poller, socket);
+    if (i == -1)
+        return -1;
+    poller->fds[i].events = to_poll_events(events);
+    poller->data[i] = data;
+    return 0;
+}
+
+int remove_poll_socket(Poller *poller, Socket socket)
+{
+    i64 i = find_poll_socket(poller, socket);
+    if (i == -1)
+        return -1;
+    poller->size--;
+    poller->fds[i] = poller->fds[poller->size];
+    poller->data[i] = poller->data[poller->size];
+    return 0;
+}
+
+int wait_poller(Poller *poller, PollEvent *events, usize max_events, i32 timeout_ms)
+{
+    if (poller->size == 0) { // WSAPoll fails on empty array
+        Sleep(timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+        return 0;
+    }
+
+    int n_ready = WSAPoll(poller->fds, (ULONG)poller->size, timeout_ms);
+    if (n_ready == SOCKET_ERROR)
+        return -1;
+    if (n_ready == 0)
+        return 0;
+
+    usize n = 0;
+    for (usize i = 0; i < poller->size && n < max_events; i++) {
+        short ev = poller->fds[i].revents;
+        if (ev == 0)
+            continue;
+        events[n].data = poller->data[i];
+        events[n].events = ((ev & POLLRDNORM) ? POLL_READ : 0) | ((ev & POLLWRNORM) ? POLL_WRITE : 0) |
+                           ((ev & (POLLERR | POLLHUP | POLLNVAL)) ? POLL_ERROR : 0);
+        n++;
+    }
+    return (int)n;
+}
+
+static short to_poll_events(u32 events)
+{
+    return ((events & POLL_READ) ? POLLRDNORM : 0) | ((events & POLL_WRITE) ? POLLWRNORM : 0);
+}
+
+static i64 find_poll_socket(Poller *poller, Socket socket)
+{
+    for (usize i = 0; i < poller->size; i++) {
+        if (poller->fds[i].fd == socket)
+            return (i64)i;
+    }
+    return -1;
+}
@@ -0,0 +1,101 @@
+#include "cross_thread.h"
+
+#include <errhandlingapi.h>
+#include <handleapi.h>
+#include <processthreadsapi.h>
+#include <synchapi.h>
+#include <sysinfoapi.h>
+#include <windows.h>
+
+#include "my_types.h"
+#include "utils.h"
+
+typedef struct {
+    ThreadFunc func;
+    void *arg;
+} ThreadStart;
+
+static DWORD WINAPI thread_start(LPVOID param);
+
+usize start_thread(Thread *thread, ThreadFunc func, void *arg)
+{
+    ThreadStart *start = xmalloc(sizeof(ThreadStart));
+    start->func = func;
+    start->arg = arg;
+
+    *thread = CreateThread(NULL, 0, thread_start, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return GetLastError();
+    }
+    return 0;
+}
+
+usize join_thread(Thread thread)
+{
+    if (WaitForSingleObject(thread, INFINITE) == WAIT_FAILED)
+        return GetLastError();
+    if (CloseHandle(thread) == 0)
+        return GetLastError();
+    return 0;
+}
+
+usize get_cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors < 1 ? 1 : info.dwNumberOfProcessors;
+}
+
+void init_mutex(Mutex *mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+void destroy_mutex(Mutex *mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+void lock_mutex(Mutex *mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+void unlock_mutex(Mutex *mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+void init_cond(CondVar *cond)
+{
+    InitializeConditionVariable(cond);
+}
+
+void destroy_cond(CondVar *cond)
+{
+    (void)cond; // Windows condition variables don't need to be deleted
+}
+
+void wait_cond(CondVar *cond, Mutex *mutex)
+{
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void signal_cond(CondVar *cond)
+{
+    WakeConditionVariable(cond);
+}
+
+void broadcast_cond(CondVar *cond)
+{
+    WakeAllConditionVariable(cond);
+}
+
+static DWORD WINAPI thread_start(LPVOID param)
+{
+    ThreadStart start = *(ThreadStart *)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}